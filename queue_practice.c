@@ -1,53 +1,63 @@
 #include <stdio.h>
 #include <signal.h>
+#include <sys/time.h>
+#include "src/ring.h"
 
-#define QSZ 20
+/*
+ * Host-side stress test for the kernel's SPSC ring (src/ring.h). A timer
+ * signal plays the part of an IRQ handler and pushes a counting sequence as
+ * fast as it can; main() is the consumer and checks that every value comes
+ * out exactly once and in order, no matter where the signal interrupted it.
+ *
+ * Build: gcc -O2 -o queue queue_practice.c && ./queue
+ */
 
-int global_array[QSZ];
+#define NITEMS 200000
 
-unsigned int RIDX = 0, WIDX = 0, nitems = 0;  
+SPSC_RING_DECLARE(int_ring, int, 4)    // 16 slots, small so it fills often
 
-int enqueue(int val) {
-    if (nitems >= QSZ) {
-        return -1;
-    }
-    
-    global_array[WIDX] = val;
-    WIDX++;
-    WIDX %= QSZ;
-    nitems++;
+struct int_ring q;
 
-    return 0;
-}
-
-int dequeue() {
-    if (nitems == 0) {
-	return -1;
-    }
-
-    int data = global_array[RIDX];
-    RIDX++;
-    RIDX %= QSZ;  
-    nitems--;
-    
-    return data;
-}
+volatile sig_atomic_t pushed = 0, dropped = 0;
 
 void sighandler(int sig) {
    static int data = 0;
-   printf("Got Signal %d\n", sig);
-   enqueue(data++);
+   // Burst several items per signal to keep the ring near full
+   for (int k = 0; k < 8 && data < NITEMS; k++) {
+      if (int_ring_push(&q, data) == 0) {
+         data++;
+         pushed++;
+      } else {
+         dropped++;
+         break;
+      }
+   }
 }
 
 int main(int argc, char **argv) {
-   signal(SIGINT, sighandler);
-   while(1) {
-      int data = dequeue();
-      if (data != -1) {
-         printf("[main] Dequeued %d\n");
+   struct itimerval it = { { 0, 10 }, { 0, 10 } };   // every 10 us
+   int expected = 0, errors = 0;
+
+   signal(SIGALRM, sighandler);
+   setitimer(ITIMER_REAL, &it, 0);
+
+   while (expected < NITEMS) {
+      int data;
+      if (int_ring_pop(&q, &data) == 0) {
+         if (data != expected) {
+            printf("[main] Dequeued %d, expected %d\n", data, expected);
+            errors++;
+            expected = data;
+         }
+         expected++;
       }
    }
-   return 0;
-}
 
+   it.it_value.tv_usec = 0;
+   it.it_interval.tv_usec = 0;
+   setitimer(ITIMER_REAL, &it, 0);
 
+   printf("pushed %d, full-ring retries %d, ordering errors %d\n",
+          (int)pushed, (int)dropped, errors);
+   return errors ? 1 : 0;
+}
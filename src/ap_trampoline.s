@@ -0,0 +1,82 @@
+;=============================================================================
+; Application processor start-up trampoline
+;
+; The startup IPI starts an AP in real mode at CS:IP = (vector << 8):0, so
+; smp_boot_aps() copies everything between ap_trampoline and
+; ap_trampoline_end to AP_TRAMPOLINE_BASE (0x8000, vector 0x08) and fills
+; in the four parameter words before sending the IPI. The code therefore
+; only uses addresses relative to that copy (see REL below), never its own
+; link address.
+;
+; The AP goes to protected mode on a throwaway flat GDT, loads the BSP's
+; CR4 and page directory, turns on paging and calls ap_entry on ap_stack.
+; ap_entry (ap_main in smp.c) installs the real per-CPU GDT and never
+; returns.
+;=============================================================================
+    global ap_trampoline
+    global ap_trampoline_end
+    global ap_cr3
+    global ap_cr4
+    global ap_stack
+    global ap_entry
+
+AP_TRAMPOLINE_BASE equ 0x8000
+CR0_PE             equ 0x00000001
+CR0_PG_WP          equ 0x80010000
+CR0_CD_NW          equ 0x60000000   ; set by INIT: caches off
+
+%define REL(x) ((x) - ap_trampoline + AP_TRAMPOLINE_BASE)
+
+    [BITS 16]
+ap_trampoline:
+    cli
+    cld
+    xor ax, ax
+    mov ds, ax
+    lgdt [REL(tramp_gdt_desc)]
+    mov eax, cr0
+    or eax, CR0_PE
+    mov cr0, eax
+    jmp dword 0x08:REL(tramp_protected)
+
+    [BITS 32]
+tramp_protected:
+    mov ax, 0x10
+    mov ds, ax
+    mov es, ax
+    mov fs, ax
+    mov gs, ax
+    mov ss, ax
+
+    mov eax, [REL(ap_cr4)]
+    mov cr4, eax
+    mov eax, [REL(ap_cr3)]
+    mov cr3, eax
+    mov eax, cr0
+    and eax, ~CR0_CD_NW
+    or eax, CR0_PG_WP
+    mov cr0, eax
+
+    mov esp, [REL(ap_stack)]
+    mov eax, [REL(ap_entry)]
+    call eax
+.halt:
+    cli
+    hlt
+    jmp .halt
+
+    align 8
+tramp_gdt:
+    dq 0                        ; null
+    dq 0x00CF9A000000FFFF       ; 0x08: flat 4 GiB code, ring 0
+    dq 0x00CF92000000FFFF       ; 0x10: flat 4 GiB data, ring 0
+tramp_gdt_desc:
+    dw tramp_gdt_desc - tramp_gdt - 1
+    dd REL(tramp_gdt)
+
+    align 4
+ap_cr3:   dd 0
+ap_cr4:   dd 0
+ap_stack: dd 0
+ap_entry: dd 0
+ap_trampoline_end:
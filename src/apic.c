@@ -0,0 +1,335 @@
+#include <stdint.h>
+#include "apic.h"
+#include "cpu.h"
+#include "io.h"
+#include "paging.h"
+#include "timer.h"
+#include "timing.h"
+#include "interrupt.h"
+
+#define MSR_APIC_BASE        0x1B
+#define APIC_BASE_ENABLE     (1 << 11)
+#define CPUID_EDX_APIC       (1 << 9)
+
+// Local APIC registers (byte offsets)
+#define LAPIC_ID             0x020
+#define LAPIC_TPR            0x080
+#define LAPIC_EOI            0x0B0
+#define LAPIC_SVR            0x0F0
+#define LAPIC_ICR_LOW        0x300
+#define LAPIC_ICR_HIGH       0x310
+#define LAPIC_LVT_TIMER      0x320
+#define LAPIC_TIMER_INIT     0x380
+#define LAPIC_TIMER_CUR      0x390
+#define LAPIC_TIMER_DIV      0x3E0
+
+#define LAPIC_SVR_ENABLE     0x100
+#define LAPIC_ICR_PENDING    (1 << 12)
+#define LVT_MASKED           (1 << 16)
+#define LVT_TIMER_PERIODIC   (1 << 17)
+#define TIMER_DIV_16         0x3
+
+// I/O APIC registers
+#define IOAPIC_REGSEL        0x00
+#define IOAPIC_WIN           0x10
+#define IOAPIC_VER           0x01
+#define IOAPIC_REDTBL(n)     (0x10 + 2 * (n))
+
+#define REDIR_MASKED         (1 << 16)
+#define REDIR_LEVEL          (1 << 15)
+#define REDIR_ACTIVE_LOW     (1 << 13)
+
+#define ISA_IRQS             16
+#define CALIBRATE_MS         10
+
+// ACPI structures we need to find the MADT
+struct acpi_rsdp {
+    char signature[8];
+    uint8_t checksum;
+    char oem_id[6];
+    uint8_t revision;
+    uint32_t rsdt_addr;
+} __attribute__((packed));
+
+struct acpi_header {
+    char signature[4];
+    uint32_t length;
+    uint8_t revision;
+    uint8_t checksum;
+    char oem_id[6];
+    char oem_table_id[8];
+    uint32_t oem_revision;
+    uint32_t creator_id;
+    uint32_t creator_revision;
+} __attribute__((packed));
+
+struct acpi_madt {
+    struct acpi_header header;
+    uint32_t lapic_addr;
+    uint32_t flags;
+} __attribute__((packed));
+
+#define MADT_LAPIC           0
+#define MADT_IOAPIC          1
+#define MADT_ISO             2
+
+int apic_enabled = 0;
+int num_cpus = 0;
+uint8_t cpu_apic_ids[MAX_CPUS];
+
+static volatile uint8_t *lapic = 0;
+static volatile uint32_t *ioapic = 0;
+static uint32_t ioapic_gsi_base = 0;
+static uint32_t lapic_timer_count = 0;
+
+// ISA IRQ -> GSI plus polarity/trigger, from interrupt source overrides
+static uint32_t isa_gsi[ISA_IRQS];
+static uint32_t isa_flags[ISA_IRQS];
+
+static uint32_t lapic_read(uint32_t reg) {
+    return *(volatile uint32_t *)(lapic + reg);
+}
+
+static void lapic_write(uint32_t reg, uint32_t val) {
+    *(volatile uint32_t *)(lapic + reg) = val;
+}
+
+static uint32_t ioapic_read(uint32_t reg) {
+    ioapic[IOAPIC_REGSEL / 4] = reg;
+    return ioapic[IOAPIC_WIN / 4];
+}
+
+static void ioapic_write(uint32_t reg, uint32_t val) {
+    ioapic[IOAPIC_REGSEL / 4] = reg;
+    ioapic[IOAPIC_WIN / 4] = val;
+}
+
+static int checksum_ok(const void *p, uint32_t len) {
+    const uint8_t *b = p;
+    uint8_t sum = 0;
+    for (uint32_t i = 0; i < len; i++) {
+        sum += b[i];
+    }
+    return sum == 0;
+}
+
+static int sig_eq(const char *a, const char *b, int n) {
+    for (int i = 0; i < n; i++) {
+        if (a[i] != b[i])
+            return 0;
+    }
+    return 1;
+}
+
+// RSDP lives in the first KiB of the EBDA or in the BIOS area, 16-byte aligned.
+static struct acpi_rsdp *find_rsdp(void) {
+    uint32_t ebda = (uint32_t)(*(uint16_t *)0x40E) << 4;
+    uint32_t ranges[2][2] = { { ebda, ebda + 1024 }, { 0xE0000, 0x100000 } };
+
+    for (int r = 0; r < 2; r++) {
+        for (uint32_t a = ranges[r][0]; a + sizeof(struct acpi_rsdp) <= ranges[r][1]; a += 16) {
+            struct acpi_rsdp *rsdp = (struct acpi_rsdp *)a;
+            if (sig_eq(rsdp->signature, "RSD PTR ", 8) && checksum_ok(rsdp, sizeof(*rsdp)))
+                return rsdp;
+        }
+    }
+    return 0;
+}
+
+// Map a whole ACPI table (its length comes from the header).
+static struct acpi_header *map_acpi_table(uint32_t paddr) {
+    struct acpi_header *h = map_mmio(paddr, sizeof(struct acpi_header));
+    if (!h)
+        return 0;
+    return map_mmio(paddr, h->length);
+}
+
+// Walk the MADT: CPUs, the first I/O APIC and ISA interrupt overrides.
+static int parse_madt(struct acpi_madt *madt) {
+    uint8_t *p = (uint8_t *)(madt + 1);
+    uint8_t *end = (uint8_t *)madt + madt->header.length;
+    uint32_t ioapic_addr = 0;
+
+    lapic = map_mmio(madt->lapic_addr, 0x1000);
+
+    while (p + 2 <= end && p[1] >= 2) {
+        switch (p[0]) {
+        case MADT_LAPIC:
+            // p[2] = ACPI id, p[3] = APIC id, p[4] bit 0 = enabled
+            if ((p[4] & 1) && num_cpus < MAX_CPUS)
+                cpu_apic_ids[num_cpus++] = p[3];
+            break;
+        case MADT_IOAPIC:
+            if (!ioapic_addr) {
+                ioapic_addr = *(uint32_t *)(p + 4);
+                ioapic_gsi_base = *(uint32_t *)(p + 8);
+            }
+            break;
+        case MADT_ISO:
+            // p[2] = bus, p[3] = ISA irq, p[4..7] = GSI, p[8..9] = flags
+            if (p[3] < ISA_IRQS) {
+                isa_gsi[p[3]] = *(uint32_t *)(p + 4);
+                isa_flags[p[3]] = *(uint16_t *)(p + 8);
+            }
+            break;
+        }
+        p += p[1];
+    }
+
+    if (!lapic || !ioapic_addr)
+        return -1;
+    ioapic = map_mmio(ioapic_addr, 0x20);
+    return ioapic ? 0 : -1;
+}
+
+static struct acpi_madt *find_madt(void) {
+    struct acpi_rsdp *rsdp = find_rsdp();
+    if (!rsdp)
+        return 0;
+
+    struct acpi_header *rsdt = map_acpi_table(rsdp->rsdt_addr);
+    if (!rsdt || !sig_eq(rsdt->signature, "RSDT", 4))
+        return 0;
+
+    uint32_t *entries = (uint32_t *)(rsdt + 1);
+    uint32_t n = (rsdt->length - sizeof(struct acpi_header)) / 4;
+    for (uint32_t i = 0; i < n; i++) {
+        struct acpi_header *h = map_mmio(entries[i], sizeof(struct acpi_header));
+        if (h && sig_eq(h->signature, "APIC", 4))
+            return (struct acpi_madt *)map_acpi_table(entries[i]);
+    }
+    return 0;
+}
+
+uint32_t lapic_id(void) {
+    return lapic_read(LAPIC_ID) >> 24;
+}
+
+// Memory-mapped EOI: one uncached store instead of port I/O to the PIC.
+void lapic_eoi(void) {
+    lapic_write(LAPIC_EOI, 0);
+}
+
+void lapic_send_ipi(uint8_t apic_id, uint32_t icr_low) {
+    lapic_write(LAPIC_ICR_HIGH, (uint32_t)apic_id << 24);
+    lapic_write(LAPIC_ICR_LOW, icr_low);
+    while (lapic_read(LAPIC_ICR_LOW) & LAPIC_ICR_PENDING);
+}
+
+// Enable this CPU's local APIC with all priorities accepted.
+void lapic_enable(void) {
+    lapic_write(LAPIC_TPR, 0);
+    lapic_write(LAPIC_SVR, LAPIC_SVR_ENABLE | APIC_SPURIOUS_VECTOR);
+}
+
+// How many LAPIC timer counts (at divide-by-16) make one scheduler tick.
+static uint32_t lapic_timer_calibrate(void) {
+    lapic_write(LAPIC_TIMER_DIV, TIMER_DIV_16);
+    lapic_write(LAPIC_LVT_TIMER, LVT_MASKED);
+    lapic_write(LAPIC_TIMER_INIT, 0xFFFFFFFF);
+
+    uint64_t end = rdtsc() + (uint64_t)tsc_khz * CALIBRATE_MS;
+    while (rdtsc() < end);
+
+    uint32_t elapsed = 0xFFFFFFFF - lapic_read(LAPIC_TIMER_CUR);
+    lapic_write(LAPIC_TIMER_INIT, 0);
+    return elapsed * (1000 / CALIBRATE_MS) / CONFIG_TIMER_HZ;
+}
+
+// Start the calling CPU's LAPIC timer as its periodic CONFIG_TIMER_HZ tick.
+void lapic_timer_start(void) {
+    lapic_write(LAPIC_TIMER_DIV, TIMER_DIV_16);
+    lapic_write(LAPIC_LVT_TIMER, IRQ_TIMER_VECTOR | LVT_TIMER_PERIODIC);
+    lapic_write(LAPIC_TIMER_INIT, lapic_timer_count);
+}
+
+/*
+ * Replace the periodic tick with one interrupt nticks ticks from now, or
+ * with none at all if nticks is 0. lapic_timer_start() goes back to
+ * periodic. Used by the tickless idle loop.
+ */
+void lapic_timer_oneshot(uint32_t nticks) {
+    uint64_t count = (uint64_t)nticks * lapic_timer_count;
+
+    lapic_write(LAPIC_TIMER_INIT, 0);
+    if (nticks == 0) {
+        lapic_write(LAPIC_LVT_TIMER, IRQ_TIMER_VECTOR | LVT_MASKED);
+        return;
+    }
+    lapic_write(LAPIC_LVT_TIMER, IRQ_TIMER_VECTOR);
+    lapic_write(LAPIC_TIMER_INIT, count > 0xFFFFFFFF ? 0xFFFFFFFF : (uint32_t)count);
+}
+
+/*
+ * Point ISA irq at vector on the CPU with dest_apic_id, honouring any MADT
+ * source override (e.g. the PIT usually arrives on GSI 2). Left masked.
+ */
+void ioapic_route(uint8_t irq, uint8_t vector, uint8_t dest_apic_id) {
+    uint32_t gsi = (irq < ISA_IRQS) ? isa_gsi[irq] : irq;
+    uint32_t flags = (irq < ISA_IRQS) ? isa_flags[irq] : 0;
+    uint32_t low = vector | REDIR_MASKED;
+
+    // MPS INTI flags: polarity in bits 0-1 (3 = active low), trigger in 2-3 (3 = level)
+    if ((flags & 0x3) == 0x3)
+        low |= REDIR_ACTIVE_LOW;
+    if (((flags >> 2) & 0x3) == 0x3)
+        low |= REDIR_LEVEL;
+
+    gsi -= ioapic_gsi_base;
+    ioapic_write(IOAPIC_REDTBL(gsi) + 1, (uint32_t)dest_apic_id << 24);
+    ioapic_write(IOAPIC_REDTBL(gsi), low);
+}
+
+void ioapic_mask(uint8_t irq) {
+    uint32_t gsi = ((irq < ISA_IRQS) ? isa_gsi[irq] : irq) - ioapic_gsi_base;
+    ioapic_write(IOAPIC_REDTBL(gsi), ioapic_read(IOAPIC_REDTBL(gsi)) | REDIR_MASKED);
+}
+
+void ioapic_unmask(uint8_t irq) {
+    uint32_t gsi = ((irq < ISA_IRQS) ? isa_gsi[irq] : irq) - ioapic_gsi_base;
+    ioapic_write(IOAPIC_REDTBL(gsi), ioapic_read(IOAPIC_REDTBL(gsi)) & ~REDIR_MASKED);
+}
+
+/*
+ * Switch interrupt delivery from the 8259s to the local and I/O APICs:
+ * find them through the ACPI MADT, mask every PIC line, route the keyboard
+ * through the I/O APIC and replace the PIT tick with the LAPIC timer.
+ * Must run with interrupts disabled, after timer_init() has calibrated the
+ * TSC. Returns -1 (and leaves the PIC in charge) if anything is missing.
+ */
+int apic_init(void) {
+    uint32_t eax, ebx, ecx, edx;
+
+    cpuid(1, &eax, &ebx, &ecx, &edx);
+    if (!(edx & CPUID_EDX_APIC) || !(edx & CPUID_EDX_MSR) || !tsc_khz)
+        return -1;
+
+    for (int i = 0; i < ISA_IRQS; i++) {
+        isa_gsi[i] = i;
+        isa_flags[i] = 0;
+    }
+
+    struct acpi_madt *madt = find_madt();
+    if (!madt || parse_madt(madt) != 0)
+        return -1;
+
+    wrmsr(MSR_APIC_BASE, rdmsr(MSR_APIC_BASE) | APIC_BASE_ENABLE);
+    lapic_enable();
+
+    // Every redirection entry starts out masked
+    uint32_t max_redir = (ioapic_read(IOAPIC_VER) >> 16) & 0xFF;
+    for (uint32_t i = 0; i <= max_redir; i++) {
+        ioapic_write(IOAPIC_REDTBL(i), REDIR_MASKED);
+    }
+
+    outb(PIC_1_DATA, 0xFF);
+    outb(PIC_2_DATA, 0xFF);
+    apic_enabled = 1;
+
+    ioapic_route(1, IRQ_KEYBOARD_VECTOR, lapic_id());
+    ioapic_unmask(1);
+
+    lapic_timer_count = lapic_timer_calibrate();
+    lapic_timer_start();
+    return 0;
+}
@@ -0,0 +1,28 @@
+#ifndef APIC_H
+#define APIC_H
+
+#include <stdint.h>
+
+#define MAX_CPUS 8
+
+#define APIC_SPURIOUS_VECTOR 0xFF
+#define RESCHED_VECTOR       0xF0   // IPI: wake an idle CPU to look for work
+#define ICR_FIXED            0x4000 // fixed delivery, level assert
+
+extern int apic_enabled;
+extern int num_cpus;
+extern uint8_t cpu_apic_ids[MAX_CPUS];
+
+int apic_init(void);
+uint32_t lapic_id(void);
+void lapic_enable(void);
+void lapic_eoi(void);
+void lapic_timer_start(void);
+void lapic_timer_oneshot(uint32_t nticks);
+void lapic_send_ipi(uint8_t apic_id, uint32_t icr_low);
+
+void ioapic_route(uint8_t irq, uint8_t vector, uint8_t dest_apic_id);
+void ioapic_mask(uint8_t irq);
+void ioapic_unmask(uint8_t irq);
+
+#endif
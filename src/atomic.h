@@ -0,0 +1,48 @@
+#ifndef ATOMIC_H
+#define ATOMIC_H
+
+#include <stdint.h>
+
+/*
+ * Locked read-modify-write primitives. With -march=i386 GCC turns the
+ * __atomic RMW builtins into libatomic calls (the 386 has no xadd or
+ * cmpxchg), so these are spelled out in asm. Plain aligned loads and stores
+ * are already atomic; use __atomic_load_n/__atomic_store_n for ordering.
+ */
+
+// Add v to *p and return the old value.
+static inline uint32_t atomic_fetch_add(volatile uint32_t *p, uint32_t v) {
+    __asm__ __volatile__("lock xaddl %0, %1"
+                         : "+r"(v), "+m"(*p)
+                         :: "memory");
+    return v;
+}
+
+// If *p == old, store new. Returns the value *p held before.
+static inline uint32_t atomic_cmpxchg(volatile uint32_t *p, uint32_t old, uint32_t new) {
+    uint32_t prev;
+    __asm__ __volatile__("lock cmpxchgl %2, %1"
+                         : "=a"(prev), "+m"(*p)
+                         : "r"(new), "0"(old)
+                         : "memory");
+    return prev;
+}
+
+static inline uint32_t atomic_xchg(volatile uint32_t *p, uint32_t v) {
+    __asm__ __volatile__("xchgl %0, %1"
+                         : "+r"(v), "+m"(*p)
+                         :: "memory");
+    return v;
+}
+
+// Full memory barrier (no mfence on the 386; any locked op orders both ways)
+static inline void smp_mb(void) {
+    __asm__ __volatile__("lock; addl $0, (%%esp)" ::: "memory", "cc");
+}
+
+// Spin-wait hint (pause; executes as a plain nop on older CPUs)
+static inline void cpu_relax(void) {
+    __asm__ __volatile__("rep; nop" ::: "memory");
+}
+
+#endif
@@ -0,0 +1,593 @@
+#include <stdint.h>
+#include "bench.h"
+#include "timing.h"
+#include "rprintf.h"
+#include "paging.h"
+#include "timer.h"
+#include "thread.h"
+#include "vm.h"
+#include "syscall.h"
+#include "fat.h"
+#include "smp.h"
+#include "atomic.h"
+#include "spinlock.h"
+#include "console.h"
+#include "serial.h"
+#include "lib/string.h"
+#include "lib/checksum.h"
+#include "dmesg.h"
+#include "io.h"
+
+extern struct page_directory_entry pd[1024];
+extern unsigned int _end_kernel;
+
+#define TLB_PASSES 64
+
+#define MAP_ITERATIONS   1000
+#define MAP_RANGE_PAGES  8
+#define WORKING_SET_PAGES 64
+#define MAP_SCRATCH_VA   0x40000000
+#define WORKING_SET_VA   0x40400000
+
+#define SWITCH_ITERATIONS 1000
+// Kernel half (global when CR4.PGE is on), but above PFA_END: the identity
+// map of [0, PFA_END) must stay intact for code that reaches frames by
+// physical address.
+#define KERNEL_WS_VA      0x20000000
+
+#define BENCH_TIMERS 4096
+
+#define SWITCH_YIELDS 10000
+
+#define CONSOLE_LINES 10000
+
+#define STRING_MIN_SIZE   1
+#define STRING_MAX_SIZE   65536
+#define STRING_BYTES      (1 << 20)   // per size, so small sizes get more calls
+
+#define CHECKSUM_JOBS     16
+#define CHECKSUM_ROUNDS   64
+#define CHECKSUM_FILE_MAX 65536
+
+#define FAULT_PAGES       32          // stays within the zeroed pool's target
+#define FAULT_VA          0x80000000
+#define FAULT_WAIT_MS     500
+
+#define MAX_BOOT_PHASES   16
+
+// QEMU's isa-debug-exit device (-device isa-debug-exit,iobase=0xf4,iosize=0x04)
+// ends the emulator with status (value << 1) | 1 when written. Without the
+// device the port is unclaimed and the write does nothing.
+#define DEBUG_EXIT_PORT   0xf4
+
+#define SYSCALL_ITERATIONS 10000
+#define USER_BENCH_CODE    0x80000000
+#define USER_BENCH_STACK   0x80001000   // one page, stack grows down from its end
+
+static struct page_directory_entry pd_scratch[1024] __attribute__((aligned(4096)));
+static struct page_directory_entry pd_4k[1024] __attribute__((aligned(4096)));
+static struct page_directory_entry pd_alt[1024] __attribute__((aligned(4096)));
+static struct timer bench_timers[BENCH_TIMERS];
+static char map_buf[MAP_RANGE_PAGES * PAGE_SIZE_4K] __attribute__((aligned(4096)));
+
+// Results also go to COM1 so the host can capture them with -serial.
+void bench_report(const char *name, uint32_t cycles) {
+    esp_wprintf(console_write, "BENCH %s %u\n", name, cycles);
+    esp_wprintf(serial_write, "BENCH %s %u\n", name, cycles);
+}
+
+static struct {
+    const char *name;
+    uint32_t cycles;
+} boot_phases[MAX_BOOT_PHASES];
+static int nr_boot_phases;
+
+// Record how long a boot phase that started at TSC t0 took. Cheap enough
+// for every build; only bench builds report the results.
+void bench_phase(const char *name, uint64_t t0) {
+    uint32_t cycles = (uint32_t)(rdtsc() - t0);
+
+    if (nr_boot_phases < MAX_BOOT_PHASES) {
+        boot_phases[nr_boot_phases].name = name;
+        boot_phases[nr_boot_phases].cycles = cycles;
+        nr_boot_phases++;
+    }
+}
+
+// One "BENCH boot_<phase> <cycles>" line per phase recorded so far.
+void bench_boot_phases(void) {
+    char name[32];
+
+    for (int i = 0; i < nr_boot_phases; i++) {
+        snprintf(name, sizeof(name), "boot_%s", boot_phases[i].name);
+        bench_report(name, boot_phases[i].cycles);
+    }
+}
+
+/*
+ * End a benchmark run: print the BENCH_END marker (so the host can tell a
+ * complete run from a crash), wait for serial to drain and leave QEMU
+ * through isa-debug-exit. Returns if the device is not there.
+ */
+void bench_exit(int status) {
+    esp_wprintf(serial_write, "BENCH_END %d\n", status);
+    dmesg_flush();
+    serial_flush();
+    outb(DEBUG_EXIT_PORT, (uint8_t)status);
+}
+
+// Read one word from every page in [start, end), TLB_PASSES times over.
+static uint32_t touch_pages(uint32_t start, uint32_t end) {
+    uint32_t sum = 0;
+    for (int pass = 0; pass < TLB_PASSES; pass++) {
+        for (uint32_t addr = start; addr < end; addr += PAGE_SIZE_4K) {
+            sum += *(volatile uint32_t *)addr;
+        }
+    }
+    return sum;
+}
+
+/*
+ * Compare the kernel identity map built from 4 MiB pages against the same
+ * range built one 4 KiB page at a time, both for setup cost and for a loop
+ * that touches one word per page (one TLB entry per page vs one in total).
+ * Must run with paging enabled on pd.
+ */
+void bench_paging(void) {
+    uint32_t kernel_end = (uint32_t)&_end_kernel;
+    uint32_t span = (kernel_end + PAGE_SIZE_4M - 1) & ~(PAGE_SIZE_4M - 1);
+    struct ppage tmp;
+    uint64_t t0, t1;
+
+    t0 = rdtsc();
+    map_region(0, 0, span, pd_scratch);
+    t1 = rdtsc();
+    bench_report("paging_setup_4m", (uint32_t)(t1 - t0));
+
+    // Same directory as pd (keeps the stack mapping), but the kernel span
+    // remapped with 4 KiB pages the way it was before PSE.
+    for (int i = 0; i < 1024; i++) {
+        pd_4k[i] = pd[i];
+    }
+    for (uint32_t i = 0; i < (span >> 22); i++) {
+        pd_4k[i].present = 0;
+    }
+    tmp.next = 0;
+    t0 = rdtsc();
+    for (uint32_t addr = 0; addr < span; addr += PAGE_SIZE_4K) {
+        tmp.physical_addr = (void *)addr;
+        map_pages((void *)addr, &tmp, pd_4k);
+    }
+    t1 = rdtsc();
+    bench_report("paging_setup_4k", (uint32_t)(t1 - t0));
+
+    loadPageDirectory(pd_4k);
+    flush_tlb_all();
+    t0 = rdtsc();
+    touch_pages(0x100000, span);
+    t1 = rdtsc();
+    bench_report("tlb_touch_4k", (uint32_t)(t1 - t0));
+
+    loadPageDirectory(pd);
+    flush_tlb_all();
+    t0 = rdtsc();
+    touch_pages(0x100000, span);
+    t1 = rdtsc();
+    bench_report("tlb_touch_4m", (uint32_t)(t1 - t0));
+}
+
+static uint32_t map_unmap_loop(void) {
+    uint32_t sum = 0;
+    for (int i = 0; i < MAP_ITERATIONS; i++) {
+        map_range((void *)MAP_SCRATCH_VA, map_buf, MAP_RANGE_PAGES, pd);
+        for (int p = 0; p < MAP_RANGE_PAGES; p++) {
+            sum += *(volatile uint32_t *)(MAP_SCRATCH_VA + p * PAGE_SIZE_4K);
+        }
+        unmap_range((void *)MAP_SCRATCH_VA, MAP_RANGE_PAGES, pd);
+        sum += touch_pages(WORKING_SET_VA, WORKING_SET_VA + WORKING_SET_PAGES * PAGE_SIZE_4K);
+    }
+    return sum;
+}
+
+/*
+ * mmap/munmap-style churn: repeatedly map, touch and unmap a small range
+ * while also touching a 4 KiB-mapped working set. Compares targeted invlpg
+ * against a full CR3 flush on every unmap. Must run with paging enabled on pd.
+ */
+void bench_map_unmap(void) {
+    uint32_t saved_threshold = tlb_flush_threshold;
+    uint64_t t0, t1;
+
+    // Working set: many virtual pages aliasing one frame, each its own TLB entry
+    for (int i = 0; i < WORKING_SET_PAGES; i++) {
+        map_range((void *)(WORKING_SET_VA + i * PAGE_SIZE_4K), map_buf, 1, pd);
+    }
+
+    t0 = rdtsc();
+    map_unmap_loop();
+    t1 = rdtsc();
+    bench_report("map_unmap_invlpg", (uint32_t)(t1 - t0));
+
+    tlb_flush_threshold = 0;
+    t0 = rdtsc();
+    map_unmap_loop();
+    t1 = rdtsc();
+    bench_report("map_unmap_full_flush", (uint32_t)(t1 - t0));
+    tlb_flush_threshold = saved_threshold;
+
+    unmap_range((void *)WORKING_SET_VA, WORKING_SET_PAGES, pd);
+}
+
+static uint32_t switch_loop(void) {
+    uint32_t sum = 0;
+    for (int i = 0; i < SWITCH_ITERATIONS; i++) {
+        loadPageDirectory((i & 1) ? pd_alt : pd);
+        for (int p = 0; p < WORKING_SET_PAGES; p++) {
+            sum += *(volatile uint32_t *)(KERNEL_WS_VA + p * PAGE_SIZE_4K);
+        }
+    }
+    loadPageDirectory(pd);
+    return sum;
+}
+
+/*
+ * Context-switch TLB refill cost: alternate CR3 between two directories that
+ * share the kernel half, touching a 4 KiB-mapped kernel working set after
+ * each switch. With CR4.PGE off every switch refills those entries; with it
+ * on they survive. Must run with paging enabled on pd.
+ */
+void bench_cr3_switch(void) {
+    uint64_t t0, t1;
+
+    for (int i = 0; i < WORKING_SET_PAGES; i++) {
+        map_range((void *)(KERNEL_WS_VA + i * PAGE_SIZE_4K), map_buf, 1, pd);
+    }
+    for (int i = 0; i < 1024; i++) {
+        pd_alt[i] = pd[i];
+    }
+
+    disable_global_pages();
+    t0 = rdtsc();
+    switch_loop();
+    t1 = rdtsc();
+    bench_report("cr3_switch_nonglobal", (uint32_t)(t1 - t0));
+
+    enable_global_pages();
+    t0 = rdtsc();
+    switch_loop();
+    t1 = rdtsc();
+    bench_report("cr3_switch_global", (uint32_t)(t1 - t0));
+
+    unmap_range((void *)KERNEL_WS_VA, WORKING_SET_PAGES, pd);
+}
+
+static void bench_timer_fn(struct timer *t, void *arg) {
+}
+
+/*
+ * Arm BENCH_TIMERS timeouts spread over every wheel level, then cancel them
+ * all. Reports total cycles for each phase; both should scale linearly.
+ */
+void bench_timer_wheel(void) {
+    uint64_t t0, t1;
+
+    for (int i = 0; i < BENCH_TIMERS; i++) {
+        timer_setup(&bench_timers[i], bench_timer_fn, 0);
+    }
+
+    t0 = rdtsc();
+    for (int i = 0; i < BENCH_TIMERS; i++) {
+        // 1 tick .. ~2^26 ticks: lands in every level of the wheel
+        timer_arm(&bench_timers[i], 1 + (uint32_t)i * i * 4);
+    }
+    t1 = rdtsc();
+    bench_report("timer_arm_4096", (uint32_t)(t1 - t0));
+
+    t0 = rdtsc();
+    for (int i = 0; i < BENCH_TIMERS; i++) {
+        timer_cancel(&bench_timers[i]);
+    }
+    t1 = rdtsc();
+    bench_report("timer_cancel_4096", (uint32_t)(t1 - t0));
+}
+
+static volatile int pingpong_go;
+static volatile int pingpong_done;
+static volatile int pingpong_last;          // 1 for ping, 2 for pong: who yielded last
+static uint32_t pingpong_stalls;            // yields that came back without a switch
+static struct spinlock pingpong_lock;
+static struct thread *pingpong_waiter;
+static uint64_t pingpong_start, pingpong_end;
+
+static void pingpong_thread(void *arg) {
+    int self = arg ? 1 : 2;
+
+    while (!pingpong_go)
+        thread_yield();
+    if (arg)
+        pingpong_start = rdtsc();
+    for (int i = 0; i < SWITCH_YIELDS; i++) {
+        pingpong_last = self;
+        thread_yield();
+        if (pingpong_last == self)
+            pingpong_stalls++;
+    }
+    if (arg)
+        pingpong_end = rdtsc();
+
+    uint32_t flags = spin_lock_irqsave(&pingpong_lock);
+    struct thread *t = ++pingpong_done == 2 ? pingpong_waiter : 0;
+    spin_unlock_irqrestore(&pingpong_lock, flags);
+    if (t)
+        thread_wake(t);
+}
+
+/*
+ * Two threads yield to each other SWITCH_YIELDS times each. They are
+ * created pinned at main's priority, so neither preempts main and neither
+ * can run alone before the other exists; main then blocks until both are
+ * done, leaving just the pair on this CPU. Each yield checks that the
+ * other thread ran in between, so a yield that switched nothing shows up
+ * as a failure rather than as a suspiciously cheap result.
+ */
+void bench_context_switch(void) {
+    int prio = current->priority;
+
+    pingpong_go = 0;
+    pingpong_done = 0;
+    pingpong_stalls = 0;
+    pingpong_waiter = current;
+    // Pinned: on two CPUs they would just yield to nobody
+    if (!thread_create_pinned("ping", pingpong_thread, (void *)1, prio))
+        return;
+    if (!thread_create_pinned("pong", pingpong_thread, 0, prio)) {
+        // ping waits on the start flag; let it run through and exit alone
+        pingpong_done = 1;
+        pingpong_waiter = 0;
+        pingpong_go = 1;
+        printk("bench_context_switch: no thread for pong\n");
+        return;
+    }
+    pingpong_go = 1;
+
+    uint32_t flags = spin_lock_irqsave(&pingpong_lock);
+    while (pingpong_done < 2) {
+        thread_block_unlock(&pingpong_lock, flags);
+        flags = spin_lock_irqsave(&pingpong_lock);
+    }
+    spin_unlock_irqrestore(&pingpong_lock, flags);
+
+    if (pingpong_stalls) {
+        printk("FAILED: ctx_switch, %d of %d yields did not switch threads\n",
+               pingpong_stalls, 2 * SWITCH_YIELDS);
+        return;
+    }
+    uint32_t total = (uint32_t)(pingpong_end - pingpong_start);
+    bench_report("ctx_switch_total", total);
+    bench_report("ctx_switch_each", total / (2 * SWITCH_YIELDS));
+}
+
+static uint32_t console_lines(void) {
+    uint64_t t0 = rdtsc();
+    for (int i = 0; i < CONSOLE_LINES; i++) {
+        esp_printf((func_ptr)putc, "console benchmark line %d of %d\n", i + 1, CONSOLE_LINES);
+    }
+    return div64_32(rdtsc() - t0, CONSOLE_LINES);
+}
+
+/*
+ * Print CONSOLE_LINES lines through the VGA console, first redrawing the
+ * whole screen from the shadow buffer on every scroll, then with CRTC
+ * hardware scrolling. Reports cycles per line.
+ */
+void bench_console(void) {
+    console_set_hw_scroll(0);
+    uint32_t copy = console_lines();
+    console_set_hw_scroll(1);
+    uint32_t hw = console_lines();
+
+    bench_report("console_line_copy", copy);
+    bench_report("console_line_hwscroll", hw);
+}
+
+// +1 so copies can also run from and to an odd address
+static uint8_t string_src[STRING_MAX_SIZE + 1] __attribute__((aligned(4096)));
+static uint8_t string_dst[STRING_MAX_SIZE + 1] __attribute__((aligned(4096)));
+
+static void byte_copy(uint8_t *d, const uint8_t *s, uint32_t n) {
+    for (uint32_t i = 0; i < n; i++) {
+        d[i] = s[i];
+    }
+}
+
+static void string_report(const char *op, uint32_t size, uint64_t cycles, uint32_t calls) {
+    char name[32];
+    snprintf(name, sizeof(name), "%s_%d", op, size);
+    bench_report(name, div64_32(cycles, calls));
+}
+
+/*
+ * lib/string.c against the byte loops it replaced, at every power of two
+ * from STRING_MIN_SIZE to STRING_MAX_SIZE. memcpy is also timed with a
+ * misaligned source. Reports cycles per call.
+ */
+void bench_string(void) {
+    for (uint32_t size = STRING_MIN_SIZE; size <= STRING_MAX_SIZE; size <<= 1) {
+        uint32_t calls = STRING_BYTES / size;
+        uint64_t t0, t1;
+
+        t0 = rdtsc();
+        for (uint32_t i = 0; i < calls; i++)
+            byte_copy(string_dst, string_src, size);
+        t1 = rdtsc();
+        string_report("bytecopy", size, t1 - t0, calls);
+
+        t0 = rdtsc();
+        for (uint32_t i = 0; i < calls; i++)
+            memcpy(string_dst, string_src, size);
+        t1 = rdtsc();
+        string_report("memcpy", size, t1 - t0, calls);
+
+        t0 = rdtsc();
+        for (uint32_t i = 0; i < calls; i++)
+            memcpy(string_dst, string_src + 1, size);
+        t1 = rdtsc();
+        string_report("memcpy_unaligned", size, t1 - t0, calls);
+
+        t0 = rdtsc();
+        for (uint32_t i = 0; i < calls; i++)
+            memset(string_dst, i, size);
+        t1 = rdtsc();
+        string_report("memset", size, t1 - t0, calls);
+    }
+}
+
+static char checksum_data[CHECKSUM_FILE_MAX];
+static uint32_t checksum_len;
+static uint32_t checksum_results[CHECKSUM_JOBS];
+static volatile uint32_t checksum_done;
+
+// Fletcher-style sum of the cached file, seeded per job, CHECKSUM_ROUNDS times.
+static void checksum_job(void *arg) {
+    uint32_t job = (uint32_t)arg;
+    uint32_t a = job + 1, b = 0;
+
+    for (int r = 0; r < CHECKSUM_ROUNDS; r++) {
+        fletcher_update(&a, &b, checksum_data, checksum_len);
+    }
+    checksum_results[job] = (b << 16) ^ a;
+    atomic_fetch_add(&checksum_done, 1);
+}
+
+/*
+ * CHECKSUM_JOBS independent checksums of bench.dat from the FAT image, one
+ * thread each. All start on this CPU's queue, so any speedup comes from
+ * idle CPUs stealing them. The file is read once up front because the IDE
+ * transfers are serialized; compare runs with "make run SMP=1" .. "SMP=4".
+ */
+void bench_parallel_checksum(void) {
+    uint64_t t0, t1;
+
+    if (fatInit() != 0) {
+        printk("bench_parallel_checksum: no FAT volume\n");
+        return;
+    }
+    struct file *f = fatOpen("bench.dat");
+    if (!f) {
+        printk("bench_parallel_checksum: bench.dat not found\n");
+        return;
+    }
+    int n = fatRead(f, checksum_data, sizeof(checksum_data));
+    fatClose(f);
+    if (n <= 0)
+        return;
+    checksum_len = n;
+    checksum_done = 0;
+
+    // Wait only for the jobs that got a thread, or a failed create hangs us
+    uint32_t started = 0;
+    t0 = rdtsc();
+    for (uint32_t j = 0; j < CHECKSUM_JOBS; j++) {
+        if (thread_create("cksum", checksum_job, (void *)j, THREAD_PRIO_DEFAULT))
+            started++;
+    }
+    while (checksum_done < started) {
+        thread_yield();
+    }
+    t1 = rdtsc();
+
+    if (started == 0) {
+        printk("bench_parallel_checksum: no threads\n");
+        return;
+    }
+    printk("%d checksum jobs ran on %d CPU(s)\n", started, cpus_online);
+    bench_report("checksum_parallel", (uint32_t)(t1 - t0));
+}
+
+// Touch FAULT_PAGES demand-zero pages in a fresh address space; cycles
+// per fault, each including the page fault round trip.
+static uint32_t fault_zero_pages(void) {
+    struct address_space *as = as_create();
+    if (!as)
+        return 0;
+    for (uint32_t i = 0; i < FAULT_PAGES; i++) {
+        if (as_reserve_user_page(as, (void *)(FAULT_VA + i * PAGE_SIZE_4K), 1) != 0) {
+            as_destroy(as);
+            return 0;
+        }
+    }
+
+    as_switch(as);
+    uint64_t t0 = rdtsc();
+    for (uint32_t i = 0; i < FAULT_PAGES; i++) {
+        *(volatile uint32_t *)(FAULT_VA + i * PAGE_SIZE_4K) = i;
+    }
+    uint64_t t1 = rdtsc();
+    as_switch(&kernel_address_space);
+    as_destroy(as);
+    return div64_32(t1 - t0, FAULT_PAGES);
+}
+
+/*
+ * Demand-zero fault latency with frames from the pre-zeroed pool (after
+ * giving the refill thread time to fill it) and with the pool bypassed,
+ * so every fault clears its frame inline.
+ */
+void bench_fault_zero(void) {
+    // The directory and the page table come out of the pool too
+    for (uint32_t waited = 0; zero_pool_count() < FAULT_PAGES + 2 && waited < FAULT_WAIT_MS; waited += 10) {
+        thread_sleep_ms(10);
+    }
+    bench_report("fault_zero_pool", fault_zero_pages());
+
+    zero_pool_enable(0);
+    bench_report("fault_zero_inline", fault_zero_pages());
+    zero_pool_enable(1);
+}
+
+static struct address_space *syscall_bench_as;
+
+static void syscall_bench_thread(void *arg) {
+    thread_enter_user(syscall_bench_as, USER_BENCH_CODE, USER_BENCH_STACK + PAGE_SIZE_4K - 8);
+}
+
+/*
+ * Null system call round trip from ring 3, through int 0x80 and through
+ * sysenter/sysexit. The loop itself (user_syscall_bench in syscall_entry.s) runs
+ * in a user thread and leaves its cycle counts at the top of its stack.
+ */
+void bench_syscall(void) {
+    uint32_t len = user_syscall_bench_end - user_syscall_bench;
+    uint32_t *args = (uint32_t *)(USER_BENCH_STACK + PAGE_SIZE_4K - 8);
+
+    syscall_bench_as = as_create();
+    if (!syscall_bench_as ||
+        as_map_user_page(syscall_bench_as, (void *)USER_BENCH_CODE, 1) != 0 ||
+        as_map_user_page(syscall_bench_as, (void *)USER_BENCH_STACK, 1) != 0) {
+        printk("bench_syscall: could not set up user pages\n");
+        return;
+    }
+
+    as_switch(syscall_bench_as);
+    for (uint32_t i = 0; i < len; i++) {
+        ((char *)USER_BENCH_CODE)[i] = user_syscall_bench[i];
+    }
+    args[0] = SYSCALL_ITERATIONS;
+    args[1] = sysenter_supported ? SYSCALL_ITERATIONS : 0;
+    as_switch(&kernel_address_space);
+
+    struct thread *t = thread_create("sysbench", syscall_bench_thread, 0, THREAD_PRIO_HIGH + 1);
+    while (t && t->state != THREAD_DEAD) {
+        thread_yield();
+    }
+
+    as_switch(syscall_bench_as);
+    uint32_t int80_cycles = args[0];
+    uint32_t sysenter_cycles = args[1];
+    as_switch(&kernel_address_space);
+
+    bench_report("syscall_int80_each", int80_cycles / SYSCALL_ITERATIONS);
+    if (sysenter_supported)
+        bench_report("syscall_sysenter_each", sysenter_cycles / SYSCALL_ITERATIONS);
+    as_destroy(syscall_bench_as);
+}
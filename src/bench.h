@@ -0,0 +1,23 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <stdint.h>
+
+// Print one result line: "BENCH <name> <cycles>"
+void bench_report(const char *name, uint32_t cycles);
+void bench_phase(const char *name, uint64_t t0);
+void bench_boot_phases(void);
+void bench_exit(int status);
+
+void bench_paging(void);
+void bench_map_unmap(void);
+void bench_cr3_switch(void);
+void bench_timer_wheel(void);
+void bench_context_switch(void);
+void bench_parallel_checksum(void);
+void bench_console(void);
+void bench_string(void);
+void bench_syscall(void);
+void bench_fault_zero(void);
+
+#endif
@@ -0,0 +1,186 @@
+#include <stdint.h>
+#include "console.h"
+#include "io.h"
+#include "spinlock.h"
+#include "lib/string.h"
+
+// CRT controller: index/data ports and the registers we program
+#define CRTC_INDEX      0x3D4
+#define CRTC_DATA       0x3D5
+#define CRTC_START_HI   0x0C
+#define CRTC_START_LO   0x0D
+#define CRTC_CURSOR_HI  0x0E
+#define CRTC_CURSOR_LO  0x0F
+
+// The colour text window at 0xB8000 is 32 KiB: 204 rows of 80 cells, of
+// which the CRTC shows the 25 starting at its start address.
+#define VRAM_CELLS      (0x8000 / 2)
+#define VRAM_ROWS       (VRAM_CELLS / VGA_COLS)
+
+#define ATTR_DEFAULT    0x07
+#define BLANK           ((ATTR_DEFAULT << 8) | ' ')
+
+static volatile uint16_t *const vram = (uint16_t *)VGA_ADDRESS;
+
+/*
+ * Everything is drawn into shadow first; it holds the visible screen as a
+ * ring of rows with the top one at shadow_top, so scrolling it is O(1).
+ * console_flush() copies rows in the dirty range [dirty_lo, dirty_hi)
+ * (screen rows) to VGA memory, starting at row vga_origin. With hardware
+ * scrolling a new line only moves vga_origin, i.e. the CRTC start address,
+ * and dirties the one new row; a full copy happens only when the origin
+ * runs off the end of VGA memory, once every VRAM_ROWS - VGA_ROWS lines.
+ */
+static uint16_t shadow[VGA_ROWS * VGA_COLS];
+static int shadow_top;
+static int dirty_lo, dirty_hi;
+static int vga_origin;
+static int hw_scroll = 1;
+static int x, y;
+static struct spinlock console_lock;
+
+static uint16_t *shadow_row(int row) {
+    return &shadow[((shadow_top + row) % VGA_ROWS) * VGA_COLS];
+}
+
+static void mark_dirty(int lo, int hi) {
+    if (dirty_lo == dirty_hi) {
+        dirty_lo = lo;
+        dirty_hi = hi;
+        return;
+    }
+    if (lo < dirty_lo)
+        dirty_lo = lo;
+    if (hi > dirty_hi)
+        dirty_hi = hi;
+}
+
+static void crtc_write(uint8_t reg, uint8_t val) {
+    outb(CRTC_INDEX, reg);
+    outb(CRTC_DATA, val);
+}
+
+static void set_start_address(uint32_t cell) {
+    crtc_write(CRTC_START_HI, cell >> 8);
+    crtc_write(CRTC_START_LO, cell & 0xFF);
+}
+
+static void set_cursor(uint32_t cell) {
+    crtc_write(CRTC_CURSOR_HI, cell >> 8);
+    crtc_write(CRTC_CURSOR_LO, cell & 0xFF);
+}
+
+static void flush_locked(void) {
+    for (int row = dirty_lo; row < dirty_hi; row++) {
+        memcpy((uint16_t *)&vram[(vga_origin + row) * VGA_COLS], shadow_row(row),
+               VGA_COLS * sizeof(uint16_t));
+    }
+    dirty_lo = dirty_hi = 0;
+    set_cursor((vga_origin + y) * VGA_COLS + x);
+}
+
+static void scroll(void) {
+    uint16_t *row;
+
+    // Rows already in VGA memory move up with the start address, so bring
+    // them up to date while they are still where the dirty range says.
+    if (hw_scroll && dirty_lo != dirty_hi)
+        flush_locked();
+
+    shadow_top = (shadow_top + 1) % VGA_ROWS;
+    row = shadow_row(VGA_ROWS - 1);
+    for (int col = 0; col < VGA_COLS; col++) {
+        row[col] = BLANK;
+    }
+
+    if (!hw_scroll) {
+        mark_dirty(0, VGA_ROWS);
+        return;
+    }
+    if (++vga_origin + VGA_ROWS > VRAM_ROWS) {
+        vga_origin = 0;
+        mark_dirty(0, VGA_ROWS);
+    } else {
+        mark_dirty(VGA_ROWS - 1, VGA_ROWS);
+    }
+    set_start_address(vga_origin * VGA_COLS);
+}
+
+// Clear the screen and take over from whatever the bootloader left.
+void console_init(void) {
+    uint32_t flags = spin_lock_irqsave(&console_lock);
+    for (int i = 0; i < VGA_ROWS * VGA_COLS; i++) {
+        shadow[i] = BLANK;
+    }
+    shadow_top = 0;
+    vga_origin = 0;
+    x = y = 0;
+    set_start_address(0);
+    mark_dirty(0, VGA_ROWS);
+    flush_locked();
+    spin_unlock_irqrestore(&console_lock, flags);
+}
+
+void console_flush(void) {
+    uint32_t flags = spin_lock_irqsave(&console_lock);
+    flush_locked();
+    spin_unlock_irqrestore(&console_lock, flags);
+}
+
+// Hardware scrolling on (default) or off, where every scroll redraws the
+// whole screen from the shadow. Off only exists for comparison.
+void console_set_hw_scroll(int enable) {
+    uint32_t flags = spin_lock_irqsave(&console_lock);
+    hw_scroll = enable;
+    vga_origin = 0;
+    set_start_address(0);
+    mark_dirty(0, VGA_ROWS);
+    flush_locked();
+    spin_unlock_irqrestore(&console_lock, flags);
+}
+
+static void put_locked(int data) {
+    if (data == '\n') {
+        x = 0;
+        y++;
+    } else {
+        shadow_row(y)[x] = (ATTR_DEFAULT << 8) | (uint8_t)data;
+        mark_dirty(y, y + 1);
+        x++;
+        if (x >= VGA_COLS) {
+            x = 0;
+            y++;
+        }
+    }
+    if (y >= VGA_ROWS) {
+        scroll();
+        y = VGA_ROWS - 1;
+    }
+}
+
+/*
+ * Draw one character into the shadow buffer. The screen itself is updated
+ * once per line (or by console_flush()), not once per character.
+ */
+int putc(int data) {
+    uint32_t flags = spin_lock_irqsave(&console_lock);
+    put_locked(data);
+    if (data == '\n')
+        flush_locked();
+    spin_unlock_irqrestore(&console_lock, flags);
+    return 0;
+}
+
+// write_func for the VGA console. Characters land in the shadow buffer; the
+// dirty rows are copied to VRAM once per chunk that ends a line.
+void console_write(const char *buf, size_t len) {
+    int newline = 0;
+    uint32_t flags = spin_lock_irqsave(&console_lock);
+    for (size_t i = 0; i < len; i++) {
+        put_locked(buf[i]);
+        newline |= buf[i] == '\n';
+    }
+    if (newline)
+        flush_locked();
+    spin_unlock_irqrestore(&console_lock, flags);
+}
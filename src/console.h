@@ -0,0 +1,16 @@
+#ifndef CONSOLE_H
+#define CONSOLE_H
+
+#include "rprintf.h"
+
+#define VGA_ADDRESS 0xB8000
+#define VGA_COLS    80
+#define VGA_ROWS    25
+
+void console_init(void);
+void console_flush(void);
+void console_set_hw_scroll(int enable);
+int putc(int data);
+void console_write(const char *buf, size_t len);
+
+#endif
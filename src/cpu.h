@@ -0,0 +1,43 @@
+#ifndef CPU_H
+#define CPU_H
+
+#include <stdint.h>
+
+#define MSR_SYSENTER_CS  0x174
+#define MSR_SYSENTER_ESP 0x175
+#define MSR_SYSENTER_EIP 0x176
+
+// CPUID leaf 1, EDX
+#define CPUID_EDX_TSC (1 << 4)
+#define CPUID_EDX_MSR (1 << 5)
+#define CPUID_EDX_SEP (1 << 11)   // SYSENTER/SYSEXIT
+#define CPUID_EDX_FXSR (1 << 24)  // FXSAVE/FXRSTOR
+#define CPUID_EDX_SSE  (1 << 25)
+#define CPUID_EDX_SSE2 (1 << 26)
+
+#define CR0_MP  (1 << 1)    // WAIT/FWAIT honour TS
+#define CR0_EM  (1 << 2)    // no x87: FPU instructions trap
+#define CR0_TS  (1 << 3)    // set on task switch: next FPU/SSE use raises #NM
+#define CR0_NE  (1 << 5)    // native x87 error reporting
+#define CR4_OSFXSR     (1 << 9)    // OS saves SSE state with FXSAVE
+#define CR4_OSXMMEXCPT (1 << 10)   // OS handles SIMD exceptions (#XM)
+
+static inline void cpuid(uint32_t leaf, uint32_t *eax, uint32_t *ebx, uint32_t *ecx, uint32_t *edx) {
+    __asm__ __volatile__("cpuid"
+                         : "=a"(*eax), "=b"(*ebx), "=c"(*ecx), "=d"(*edx)
+                         : "a"(leaf), "c"(0));
+}
+
+static inline uint64_t rdmsr(uint32_t msr) {
+    uint64_t ret;
+    __asm__ __volatile__("rdmsr" : "=A"(ret) : "c"(msr));
+    return ret;
+}
+
+static inline void wrmsr(uint32_t msr, uint64_t val) {
+    __asm__ __volatile__("wrmsr"
+                         :
+                         : "c"(msr), "a"((uint32_t)val), "d"((uint32_t)(val >> 32)));
+}
+
+#endif
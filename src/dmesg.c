@@ -0,0 +1,191 @@
+#include <stdint.h>
+#include "dmesg.h"
+#include "atomic.h"
+#include "spinlock.h"
+#include "console.h"
+#include "serial.h"
+#include "thread.h"
+#include "event.h"
+#include "timer.h"
+#include "timing.h"
+#include "lib/string.h"
+
+#define LOG_BUF_SIZE   (1u << LOG_BUF_ORDER)
+#define LOG_BUF_MASK   (LOG_BUF_SIZE - 1)
+#define LOG_ALIGN      16     // records never leave less than a header before the end
+#define LOG_PAD        0x01   // filler up to the end of the buffer, no text
+
+/*
+ * Kernel log. printk() formats on the caller's stack, reserves space in
+ * log_buf and copies the text in; klogd later writes it to the VGA console
+ * and COM1. Positions are free-running byte counts, the buffer offset is
+ * the low LOG_BUF_ORDER bits.
+ *
+ * Producers reserve by advancing head with cmpxchg, so any number of CPUs
+ * and interrupt handlers may log at once without a lock. A record is
+ * published by storing its own position + 1 into seq last (release); the
+ * consumer only trusts a record whose seq matches the position it expects,
+ * which also rejects zeroed memory and stale bytes left by older records. Records do not
+ * wrap: one that would is preceded by a LOG_PAD record filling the rest of
+ * the buffer. When the buffer is full, messages are dropped and counted
+ * rather than overwriting what the consumer has not read.
+ */
+struct log_rec {
+    volatile uint32_t seq;  // position + 1 (never 0), written on commit
+    uint16_t size;          // whole record, header included, LOG_ALIGN multiple
+    uint16_t flags;
+    uint64_t tsc;           // rdtsc() at printk() time
+    char text[];            // size - sizeof(struct log_rec) bytes, NUL padded
+};
+
+static uint8_t log_buf[LOG_BUF_SIZE] __attribute__((aligned(LOG_ALIGN)));
+static volatile uint32_t log_head;     // next position to reserve
+static volatile uint32_t log_tail;     // next position to read, consumer only
+static volatile uint32_t log_dropped;
+static struct spinlock consumer_lock;  // one consumer at a time, taken with trylock
+static int at_line_start = 1;          // consumer only
+static int klogd_running;
+static struct event klogd_event;       // records committed since klogd last looked
+
+static struct log_rec *rec_at(uint32_t pos) {
+    return (struct log_rec *)&log_buf[pos & LOG_BUF_MASK];
+}
+
+// Reserve size contiguous bytes, padding out the end of the buffer first
+// if needed. Stores the record's position in *out; -1 if the log is full.
+static int reserve(uint32_t size, uint32_t *out) {
+    uint32_t pos, off, pad;
+
+    do {
+        pos = log_head;
+        off = pos & LOG_BUF_MASK;
+        pad = (off + size > LOG_BUF_SIZE) ? LOG_BUF_SIZE - off : 0;
+        if (pos + pad + size - __atomic_load_n(&log_tail, __ATOMIC_ACQUIRE) > LOG_BUF_SIZE)
+            return -1;
+    } while (atomic_cmpxchg(&log_head, pos, pos + pad + size) != pos);
+
+    if (pad) {
+        struct log_rec *r = rec_at(pos);
+        r->size = pad;
+        r->flags = LOG_PAD;
+        __atomic_store_n(&r->seq, pos + 1, __ATOMIC_RELEASE);
+    }
+    *out = pos + pad;
+    return 0;
+}
+
+/*
+ * Append a message to the log. Safe from any context; costs one format
+ * into a stack buffer and one copy, then wakes klogd. Before klogd runs,
+ * the log is drained synchronously so early boot output appears at once.
+ */
+void vprintk(charptr ctrl, va_list argp) {
+    char text[LOG_LINE_MAX];
+    uint32_t len, size, pos;
+    uint64_t tsc = rdtsc();
+
+    len = vsnprintf(text, sizeof(text), ctrl, argp);
+    if (len >= sizeof(text))
+        len = sizeof(text) - 1;
+    size = (sizeof(struct log_rec) + len + 1 + LOG_ALIGN - 1) & ~(LOG_ALIGN - 1);
+
+    if (reserve(size, &pos) != 0) {
+        // Full: make room ourselves if nobody else is draining, else drop.
+        dmesg_flush();
+        if (reserve(size, &pos) != 0) {
+            atomic_fetch_add(&log_dropped, 1);
+            return;
+        }
+    }
+
+    struct log_rec *r = rec_at(pos);
+    r->size = size;
+    r->flags = 0;
+    r->tsc = tsc;
+    memcpy(r->text, text, len);
+    memset(r->text + len, 0, size - sizeof(struct log_rec) - len);
+    __atomic_store_n(&r->seq, pos + 1, __ATOMIC_RELEASE);
+
+    if (klogd_running)
+        event_signal(&klogd_event);
+    else
+        dmesg_flush();
+}
+
+void printk(charptr ctrl, ...) {
+    va_list args;
+    va_start(args, ctrl);
+    vprintk(ctrl, args);
+    va_end(args);
+}
+
+// Both sinks get the same bytes; each new line starts with a timestamp.
+static void emit(const char *buf, size_t len) {
+    console_write(buf, len);
+    serial_write(buf, len);
+}
+
+static void emit_record(struct log_rec *r) {
+    const char *p = r->text;
+
+    while (*p) {
+        if (at_line_start) {
+            uint32_t ms = tsc_khz ? div64_32(r->tsc, tsc_khz) : 0;
+            esp_wprintf(emit, "[%5d.%03d] ", ms / 1000, ms % 1000);
+        }
+        const char *eol = p;
+        while (*eol && *eol != '\n')
+            eol++;
+        if (*eol == '\n')
+            eol++;
+        emit(p, eol - p);
+        at_line_start = eol[-1] == '\n';
+        p = eol;
+    }
+}
+
+/*
+ * Write every committed record to the sinks, stopping at the first one
+ * still being filled in. Callable from anywhere; if another CPU is already
+ * draining (possibly the code this interrupt preempted), returns at once
+ * and leaves the work to it.
+ */
+void dmesg_flush(void) {
+    if (!spin_trylock(&consumer_lock))
+        return;
+
+    uint32_t tail = log_tail;
+    while (1) {
+        struct log_rec *r = rec_at(tail);
+        if (tail == log_head || __atomic_load_n(&r->seq, __ATOMIC_ACQUIRE) != tail + 1)
+            break;
+        if (!(r->flags & LOG_PAD))
+            emit_record(r);
+        tail += r->size;
+        __atomic_store_n(&log_tail, tail, __ATOMIC_RELEASE);
+    }
+
+    spin_unlock(&consumer_lock);
+
+    uint32_t dropped = atomic_xchg(&log_dropped, 0);
+    if (dropped)
+        printk("dmesg: %d message(s) dropped\n", dropped);
+}
+
+uint32_t dmesg_dropped(void) {
+    return log_dropped;
+}
+
+// Sleeps until vprintk() commits something, so an idle system stays idle.
+static void klogd(void *arg) {
+    while (1) {
+        event_wait(&klogd_event);
+        dmesg_flush();
+    }
+}
+
+// Hand draining over to a thread. Call once the scheduler is running.
+void dmesg_start(void) {
+    thread_create("klogd", klogd, 0, THREAD_PRIO_DEFAULT - 1);
+    klogd_running = 1;
+}
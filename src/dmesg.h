@@ -0,0 +1,15 @@
+#ifndef DMESG_H
+#define DMESG_H
+
+#include <stdint.h>
+#include "rprintf.h"
+
+#define LOG_BUF_ORDER  16     // 64 KiB of records
+#define LOG_LINE_MAX   512    // longest message printk() keeps
+
+void vprintk(charptr ctrl, va_list argp);
+void dmesg_flush(void);
+void dmesg_start(void);
+uint32_t dmesg_dropped(void);
+
+#endif
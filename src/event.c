@@ -0,0 +1,37 @@
+#include <stdint.h>
+#include "event.h"
+#include "thread.h"
+
+// Block until e is signalled, then clear it. One waiter at a time.
+void event_wait(struct event *e) {
+    uint32_t flags = spin_lock_irqsave(&e->lock);
+
+    while (!e->pending) {
+        e->waiter = current;
+        thread_block_unlock(&e->lock, flags);
+        flags = spin_lock_irqsave(&e->lock);
+    }
+    e->pending = 0;
+    spin_unlock_irqrestore(&e->lock, flags);
+
+    // Orders the clear before the caller's reads of the published data;
+    // pairs with the fence in event_signal()
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+void event_signal(struct event *e) {
+    // Either we see pending cleared, or the consumer sees our data
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (e->pending)
+        return;
+
+    uint32_t flags = spin_lock_irqsave(&e->lock);
+    struct thread *t = e->waiter;
+
+    e->pending = 1;
+    e->waiter = 0;
+    spin_unlock_irqrestore(&e->lock, flags);
+
+    if (t)
+        thread_wake(t);
+}
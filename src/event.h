@@ -0,0 +1,26 @@
+#ifndef EVENT_H
+#define EVENT_H
+
+#include "spinlock.h"
+
+struct thread;
+
+/*
+ * Wakeup flag for one consumer thread fed from any context. Producers
+ * publish their data, then event_signal(); the consumer loops on
+ * event_wait() and then drains everything published. A signal that
+ * arrives while nobody waits is kept, so none is lost, and signals sent
+ * before the consumer runs again collapse into one. event_signal() is
+ * safe from interrupt handlers and costs a fence when already pending.
+ * A zero-initialized event is clear.
+ */
+struct event {
+    struct spinlock lock;            // guards waiter and the clear/set of pending
+    struct thread *waiter;
+    volatile int pending;
+};
+
+void event_wait(struct event *e);
+void event_signal(struct event *e);
+
+#endif
@@ -1,5 +1,8 @@
 #include "fat.h"
 #include "ide.h"
+#include "mutex.h"
+#include "lib/string.h"
+#include "trace.h"
 #include <stddef.h>
 
 // Global variables
@@ -13,16 +16,33 @@ static int data_region_start = 0;
 // FAT filesystem starts at sector 2048 (1MB offset) due to partition table
 #define FAT_OFFSET 2048
 
-/**
- * fatInit - Initialize FAT filesystem driver
- * Reads the boot sector and FAT table into memory
- * Returns: 0 on success, -1 on failure
- */
-int fatInit(void) {
+// fat_lock guards the cached boot sector, FAT and root directory plus the
+// open file table; disk_lock serializes the PIO transfers themselves. Both
+// are sleeping locks: they are held across disk transfers with interrupts
+// on. A struct file's position belongs to its one user; sharing an open
+// file between threads needs the caller's own locking.
+static struct mutex fat_lock;
+static struct mutex disk_lock;
+static struct file open_files[FAT_MAX_OPEN];
+static char open_used[FAT_MAX_OPEN];
+
+static int disk_read(unsigned int lba, char *buffer, unsigned int numsectors) {
+    trace_begin("disk_wait", lba);
+    mutex_lock(&disk_lock);
+    trace_end("disk_wait", lba);
+    trace_begin("disk_read", lba);
+    int result = ata_lba_read(lba, (unsigned char*)buffer, numsectors);
+    trace_end("disk_read", lba);
+    mutex_unlock(&disk_lock);
+    return result;
+}
+
+// fatInit() body; caller holds fat_lock
+static int fat_init_locked(void) {
     int result;
     
     // Read boot sector from disk (FAT starts at sector 2048 due to partition table)
-    result = ata_lba_read(FAT_OFFSET, (unsigned char*)boot_sector, 1);
+    result = disk_read(FAT_OFFSET, boot_sector, 1);
     if (result != 0) {
         return -1;  // Disk read failed
     }
@@ -43,14 +63,14 @@ int fatInit(void) {
     data_region_start = root_dir_region_start + root_dir_sectors;
     
     // Read FAT table into memory
-    result = ata_lba_read(FAT_OFFSET + bs->num_reserved_sectors, (unsigned char*)fat_table, 
+    result = disk_read(FAT_OFFSET + bs->num_reserved_sectors, fat_table, 
                          bs->num_sectors_per_fat);
     if (result != 0) {
         return -3;  // FAT read failed
     }
     
     // Read root directory region into memory
-    result = ata_lba_read(root_dir_region_start, (unsigned char*)root_directory_region, 
+    result = disk_read(root_dir_region_start, root_directory_region, 
                          root_dir_sectors);
     if (result != 0) {
         return -4;  // Root directory read failed
@@ -59,6 +79,20 @@ int fatInit(void) {
     return 0;
 }
 
+/**
+ * fatInit - Initialize FAT filesystem driver
+ * Reads the boot sector and FAT table into memory
+ * Returns: 0 on success, -1 on failure
+ */
+int fatInit(void) {
+    trace_begin("fat_init", 0);
+    mutex_lock(&fat_lock);
+    int result = fat_init_locked();
+    mutex_unlock(&fat_lock);
+    trace_end("fat_init", 0);
+    return result;
+}
+
 // Helper: Extract readable filename from RDE
 static void extract_filename(struct root_directory_entry *rde, char *fname) {
     int k = 0;
@@ -96,15 +130,22 @@ static int strcmp_nocase(const char *s1, const char *s2) {
 /**
  * fatOpen - Open a file in the FAT filesystem
  * Searches root directory for the file and returns file structure
- * Returns: pointer to file structure on success, NULL if not found
+ * Returns: pointer to file structure on success, NULL if not found or
+ * if all FAT_MAX_OPEN slots are in use. Release it with fatClose().
  */
 struct file* fatOpen(const char *filename) {
-    if (!bs) return 0;
+    struct file *f = 0;
+
+    mutex_lock(&fat_lock);
+    if (!bs) {
+        mutex_unlock(&fat_lock);
+        return 0;
+    }
     
     struct root_directory_entry *rde = (struct root_directory_entry*)root_directory_region;
     
     // Search through root directory entries
-    for (int k = 0; k < bs->num_root_dir_entries; k++) {
+    for (int k = 0; k < bs->num_root_dir_entries && !f; k++) {
         // Skip empty/deleted entries
         if (rde[k].file_name[0] == 0x00 || rde[k].file_name[0] == 0xE5) {
             continue;
@@ -121,77 +162,116 @@ struct file* fatOpen(const char *filename) {
         
         if (strcmp_nocase(fname, filename) == 0) {
             // Found the file!
-            static struct file f;
-            f.rde = rde[k];
-            f.start_cluster = rde[k].cluster;
-            f.current_position = 0;
-            f.next = 0;
-            f.prev = 0;
-            return &f;
+            for (int i = 0; i < FAT_MAX_OPEN; i++) {
+                if (!open_used[i]) {
+                    open_used[i] = 1;
+                    f = &open_files[i];
+                    break;
+                }
+            }
+            if (!f)
+                break;  // Out of file slots
+            f->rde = rde[k];
+            f->start_cluster = rde[k].cluster;
+            f->current_position = 0;
+            f->next = 0;
+            f->prev = 0;
         }
     }
     
-    return 0; // File not found
+    mutex_unlock(&fat_lock);
+    return f; // NULL if not found
 }
 
-// Helper: Get next cluster from FAT
+/**
+ * fatClose - Release a file returned by fatOpen()
+ */
+void fatClose(struct file *f) {
+    if (!f)
+        return;
+
+    mutex_lock(&fat_lock);
+    open_used[f - open_files] = 0;
+    mutex_unlock(&fat_lock);
+}
+
+// Helper: Get next cluster from FAT; caller holds fat_lock
 static uint16_t get_next_cluster(uint16_t cluster) {
     uint16_t *fat = (uint16_t*)fat_table;
     uint16_t next = fat[cluster];
     return (next >= 0xFFF8) ? 0 : next; // 0 means end of chain
 }
 
-/**
- * fatRead - Read data from a file into a buffer
- * Reads up to 'size' bytes from the file into buffer
- * Returns: number of bytes read, or -1 on error
+/*
+ * fatRead() body. The FAT lookups and the geometry are read under
+ * fat_lock; the cluster transfers run without it, so reads of different
+ * files overlap their disk waits.
  */
-int fatRead(struct file *f, char *buffer, unsigned int size) {
-    if (!f || !buffer || !bs) return -1;
-    
+static int fat_read_file(struct file *f, char *buffer, unsigned int size) {
+    mutex_lock(&fat_lock);
+    if (!bs) {
+        mutex_unlock(&fat_lock);
+        return -1;
+    }
+
     // Calculate how much we can read
     uint32_t remaining = f->rde.file_size - f->current_position;
     uint32_t to_read = (size < remaining) ? size : remaining;
-    
-    if (to_read == 0) return 0;
-    
     uint32_t bytes_read = 0;
     uint16_t cluster = f->start_cluster;
-    uint32_t cluster_size = bs->num_sectors_per_cluster * bs->bytes_per_sector;
+    uint32_t sectors_per_cluster = bs->num_sectors_per_cluster;
+    uint32_t cluster_size = sectors_per_cluster * bs->bytes_per_sector;
+    uint32_t data_start = data_region_start;
     char cluster_buf[CLUSTER_SIZE];
-    
+
     // Skip to current position in file
     uint32_t skip = f->current_position;
     while (skip >= cluster_size && cluster != 0) {
         cluster = get_next_cluster(cluster);
         skip -= cluster_size;
     }
-    
+    mutex_unlock(&fat_lock);
+
     // Read clusters and copy data to buffer
     while (bytes_read < to_read && cluster != 0) {
         // Read cluster from disk (cluster 2 is first data cluster)
-        uint32_t sector = data_region_start + (cluster - 2) * bs->num_sectors_per_cluster;
-        
-        if (ata_lba_read(sector, (unsigned char*)cluster_buf, bs->num_sectors_per_cluster) != 0) {
+        uint32_t sector = data_start + (cluster - 2) * sectors_per_cluster;
+
+        if (disk_read(sector, cluster_buf, sectors_per_cluster) != 0) {
             return -1;
         }
-        
+
         // Copy from cluster to buffer
         uint32_t offset = (bytes_read == 0) ? skip : 0;
         uint32_t available = cluster_size - offset;
         uint32_t copy = (to_read - bytes_read < available) ? (to_read - bytes_read) : available;
-        
-        for (uint32_t i = 0; i < copy; i++) {
-            buffer[bytes_read++] = cluster_buf[offset + i];
-        }
-        
+
+        memcpy(buffer + bytes_read, cluster_buf + offset, copy);
+        bytes_read += copy;
+
         f->current_position += copy;
-        
+
         // Get next cluster if we need more data
         if (bytes_read < to_read) {
+            mutex_lock(&fat_lock);
             cluster = get_next_cluster(cluster);
+            mutex_unlock(&fat_lock);
         }
     }
-    
+
     return bytes_read;
 }
+
+/**
+ * fatRead - Read data from a file into a buffer
+ * Reads up to 'size' bytes from the file into buffer
+ * Returns: number of bytes read, or -1 on error
+ */
+int fatRead(struct file *f, char *buffer, unsigned int size) {
+    if (!f || !buffer) return -1;
+
+    trace_begin("fat_read", size);
+    int result = fat_read_file(f, buffer, size);
+    trace_end("fat_read", size);
+    return result;
+}
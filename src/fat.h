@@ -7,6 +7,7 @@
 #define CLUSTER_SIZE 4096
 #define SECTORS_PER_CLUSTER (CLUSTER_SIZE / SECTOR_SIZE)
 #define FILE_ATTRIBUTE_SUBDIRECTORY 0x10
+#define FAT_MAX_OPEN 16
 
 /*
  * Boot sector structure for FAT FS
@@ -69,6 +70,7 @@ struct file {
 // Function prototypes
 int fatInit(void);
 struct file* fatOpen(const char *filename);
+void fatClose(struct file *f);
 int fatRead(struct file *f, char *buffer, unsigned int size);
 
 #endif
@@ -0,0 +1,161 @@
+#include <stdint.h>
+#include "fpu.h"
+#include "cpu.h"
+#include "smp.h"
+#include "thread.h"
+#include "interrupt.h"
+#include "serial.h"
+
+#ifdef CONFIG_SSE
+
+#define MXCSR_DEFAULT 0x1F80   // all SIMD exceptions masked, round to nearest
+
+/*
+ * Lazy FPU/SSE context switching. A thread's x87/SSE registers are only
+ * restored when it first touches them after being switched in: the switch
+ * sets CR0.TS, that use raises #NM, and fpu_nm_trap() loads the thread's
+ * FXSAVE image. Threads that never use the FPU, which is almost all of
+ * them, never pay for it.
+ *
+ * A thread that did use the FPU is saved when it is switched out, so its
+ * image in memory is always current and it can migrate freely. Each CPU
+ * remembers whose state its registers still hold (fpu_owner); if that
+ * thread comes back before anyone else has touched the FPU there and has
+ * not run elsewhere meanwhile (fpu_cpu), TS is left clear and there is no
+ * trap at all.
+ *
+ * The kernel is built with -mgeneral-regs-only, so the compiler never
+ * touches these registers itself; kernel code that wants SSE brackets it
+ * with kernel_fpu_begin()/kernel_fpu_end().
+ */
+
+int cpu_has_sse2;
+
+static inline uint32_t read_cr0(void) {
+    uint32_t cr0;
+    asm volatile("mov %%cr0, %0" : "=r"(cr0));
+    return cr0;
+}
+
+static inline void clts(void) {
+    asm volatile("clts" ::: "memory");
+}
+
+static inline void stts(void) {
+    asm volatile("mov %%cr0, %%eax\n"
+                 "or %0, %%eax\n"
+                 "mov %%eax, %%cr0"
+                 :: "i"(CR0_TS) : "eax", "memory");
+}
+
+static inline void fxsave(struct fpu_state *s) {
+    asm volatile("fxsave %0" : "=m"(*s));
+}
+
+static inline void fxrstor(struct fpu_state *s) {
+    asm volatile("fxrstor %0" :: "m"(*s));
+}
+
+static void fpu_reset(void) {
+    uint32_t mxcsr = MXCSR_DEFAULT;
+    asm volatile("fninit\n"
+                 "ldmxcsr %0" :: "m"(mxcsr));
+}
+
+/*
+ * Per-CPU setup, on the BSP from main and on each AP from ap_main. Turns
+ * on FXSAVE and SSE if CPUID has them (cpu_has_sse2 comes from the BSP;
+ * all CPUs are assumed alike) and arms the first #NM.
+ */
+void fpu_init(void) {
+    uint32_t eax, ebx, ecx, edx;
+    struct cpu *c = this_cpu();
+
+    cpuid(1, &eax, &ebx, &ecx, &edx);
+    if (!(edx & CPUID_EDX_FXSR) || !(edx & CPUID_EDX_SSE2))
+        return;
+
+    asm volatile("mov %%cr4, %%eax\n"
+                 "or %0, %%eax\n"
+                 "mov %%eax, %%cr4"
+                 :: "i"(CR4_OSFXSR | CR4_OSXMMEXCPT) : "eax");
+    asm volatile("mov %%cr0, %%eax\n"
+                 "and %0, %%eax\n"
+                 "or %1, %%eax\n"
+                 "mov %%eax, %%cr0"
+                 :: "i"(~(CR0_EM | CR0_TS)), "i"(CR0_MP | CR0_NE) : "eax");
+    fpu_reset();
+    c->fpu_owner = 0;
+    stts();
+    if (c->id == 0)
+        cpu_has_sse2 = 1;
+}
+
+// From schedule(), interrupts off, just before switching from prev to next.
+void fpu_switch(struct thread *prev, struct thread *next) {
+    struct cpu *c = this_cpu();
+
+    if (!cpu_has_sse2)
+        return;
+
+    // TS clear while prev ran: its registers are newer than its image
+    if (c->fpu_owner == prev && !(read_cr0() & CR0_TS))
+        fxsave(&prev->fpu);
+
+    if (c->fpu_owner == next && next->fpu_cpu == c->id)
+        clts();
+    else
+        stts();
+}
+
+// #NM: the current thread touched the FPU with TS set. Give it its state.
+void fpu_nm_trap(void) {
+    struct cpu *c = this_cpu();
+    struct thread *t = c->current_thread;
+
+    clts();
+    if (!t)
+        return;
+
+    if (t->fpu_used) {
+        fxrstor(&t->fpu);
+    } else {
+        fpu_reset();
+        t->fpu_used = 1;
+    }
+    c->fpu_owner = t;
+    t->fpu_cpu = c->id;
+}
+
+/*
+ * Let kernel code use the SSE registers until kernel_fpu_end(). Saves the
+ * interrupted or current thread's live state first. Interrupts stay off
+ * in between, so keep the section short and do not sleep in it. Callable
+ * from interrupt handlers. Not nestable: a nested or unbalanced bracket
+ * would corrupt someone's registers, so it panics.
+ */
+void kernel_fpu_begin(void) {
+    uint32_t flags = irq_save();
+    struct cpu *c = this_cpu();
+
+    if (c->kernel_fpu_active)
+        panic("nested kernel_fpu_begin() on cpu%d\n", c->id);
+    c->kernel_fpu_active = 1;
+    if (c->fpu_owner && c->fpu_owner == c->current_thread && !(read_cr0() & CR0_TS))
+        fxsave(&c->fpu_owner->fpu);
+    c->fpu_owner = 0;   // registers are about to be clobbered
+    clts();
+    c->kernel_fpu_flags = flags;
+}
+
+void kernel_fpu_end(void) {
+    struct cpu *c = this_cpu();
+
+    if (!c->kernel_fpu_active)
+        panic("kernel_fpu_end() without kernel_fpu_begin() on cpu%d\n", c->id);
+    c->kernel_fpu_active = 0;
+    stts();
+    irq_restore(c->kernel_fpu_flags);
+}
+
+#endif
@@ -0,0 +1,28 @@
+#ifndef FPU_H
+#define FPU_H
+
+#include <stdint.h>
+
+struct thread;
+
+// FXSAVE image: x87, MMX and SSE registers plus MXCSR
+struct fpu_state {
+    uint8_t fxsave[512];
+} __attribute__((aligned(16)));
+
+#ifdef CONFIG_SSE
+extern int cpu_has_sse2;
+
+void fpu_init(void);
+void fpu_switch(struct thread *prev, struct thread *next);
+void fpu_nm_trap(void);
+void kernel_fpu_begin(void);
+void kernel_fpu_end(void);
+#else
+#define cpu_has_sse2 0
+static inline void fpu_init(void) {}
+static inline void fpu_switch(struct thread *prev, struct thread *next) {}
+static inline void fpu_nm_trap(void) {}
+#endif
+
+#endif
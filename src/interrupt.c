@@ -1,18 +1,61 @@
 
 #include <stdint.h>
 #include "interrupt.h"
+#include "vm.h"
+#include "timer.h"
+#include "thread.h"
+#include "ring.h"
+#include "cpu.h"
+#include "syscall.h"
+#include "apic.h"
+#include "smp.h"
+#include "irqstat.h"
+#include "softirq.h"
+#include "keyboard.h"
+#include "prof.h"
+#include "serial.h"
+#include "rprintf.h"
+#include "lib/string.h"
+#include "fpu.h"
+#include "trace.h"
+
+#define KEYBOARD_DATA_PORT 0x60
+
+SPSC_RING_DECLARE(scancode_ring, uint8_t, 7)
+
+// Filled by keyboard_handler(), drained by keyboard_read_scancode()
+static struct scancode_ring kbd_ring;
+
+static void keyboard_work_fn(struct work *w, void *arg) {
+    keyboard_decode();
+}
+
+static struct work keyboard_work = { .fn = keyboard_work_fn };
+
+/*
+ * Common entry for device interrupts: IRQ_HANDLER(name, vector) { body }
+ * defines the interrupt-attribute function name, which runs irq_enter(),
+ * times and traces body for irqstat and trace.c and then runs irq_exit().
+ * Anything that may switch threads belongs in irq_exit(), not in the
+ * body, so it is not billed to the IRQ.
+ */
+#define IRQ_HANDLER(name, vector)                                          \
+    static void name##_body(struct interrupt_frame *frame);                \
+    __attribute__((interrupt)) void name(struct interrupt_frame *frame) {  \
+        irq_enter(vector);                                                 \
+        uint64_t t0 = irqstat_enter();                                     \
+        trace_handler_begin(#name, vector);                                \
+        name##_body(frame);                                                \
+        trace_handler_end(#name, vector);                                  \
+        irqstat_exit(vector, t0);                                          \
+        irq_exit();                                                        \
+    }                                                                      \
+    static void name##_body(struct interrupt_frame *frame)
 
 struct idt_entry idt_entries[256];
 struct idt_ptr   idt_ptr;
-struct tss_entry tss_ent;
 
 
-void memset(char *s, char c, unsigned int n) {
-    for(int k = 0; k < n ; k++) {
-        s[k] = c;
-    }
-}
-
 void tss_flush (uint16_t tss) {
   asm("ltr %0" : :"a"(tss));
 }
@@ -124,25 +167,25 @@ void load_gdt() {
 
 
     asm("cli\n"
-        "lgdt [gdt_desc]\n"     // Load the new GDT
+        "lgdt gdt_desc\n"     // Load the new GDT
         "ljmp $0x8,$gdt_flush\n"   // Far jump to update the CS
 "gdt_flush:\n"
-        "mov %%eax, 0x10\n"       // set data segments to data selector (0x10)
-        "mov %%ds, %%eax\n"
-        "mov %%ss, %%eax\n"
-        "mov %%es, %%eax\n"
-        "mov %%fs, %%eax\n"
-        "mov %%gs, %%eax\n" : : : "eax");
+        "mov $0x10, %%eax\n"       // set data segments to data selector (0x10)
+        "mov %%ax, %%ds\n"
+        "mov %%ax, %%ss\n"
+        "mov %%ax, %%es\n"
+        "mov %%ax, %%fs\n"
+        "mov %%ax, %%gs\n" : : : "eax");
 
 }
 
 
 
-void write_tss(struct gdt_entry_bits *g) {
+// Point GDT slot g at tss and initialize it with kernel stack esp0. Does not ltr.
+void write_tss(struct gdt_entry_bits *g, struct tss_entry *tss, uint32_t esp0) {
     // Firstly, let's compute the base and limit of our entry into the GDT.
-    uint32_t base = (uint32_t) &tss_ent;
+    uint32_t base = (uint32_t) tss;
     uint32_t limit = base + sizeof(struct tss_entry);
-    extern uint32_t stack_top;
 
     // Now, add our TSS descriptor's address to the GDT.
     g->limit_low = limit & 0xFFFF;
@@ -162,17 +205,13 @@ void write_tss(struct gdt_entry_bits *g) {
     g->base_high = (base & 0xFF000000)>>24; //isolate top byte.
 
     // Ensure the TSS is initially zero'd.
-    memset(&tss_ent, 0, sizeof(tss_ent));
-
-    extern int _end_stack;
+    memset(tss, 0, sizeof(*tss));
 
-    tss_ent.ss0  = 16;  // Set the kernel stack segment.
-    tss_ent.esp0 = (uint32_t)&_end_stack; // Set the kernel stack pointer.
-    tss_ent.cs   = 0x0b;
-    tss_ent.ss = tss_ent.ds = tss_ent.es = tss_ent.fs = tss_ent.gs = 0x13;
+    tss->ss0  = 16;  // Set the kernel stack segment.
+    tss->esp0 = esp0; // Set the kernel stack pointer.
+    tss->cs   = 0x0b;
+    tss->ss = tss->ds = tss->es = tss->fs = tss->gs = 0x13;
     //note that CS is loaded from the IDT entry and should be the regular kernel code segment
-
-    tss_flush(0x2b);
 }
 
 
@@ -180,6 +219,12 @@ void write_tss(struct gdt_entry_bits *g) {
 
 
 
+// Stack the CPU switches to on a ring 3 -> ring 0 transition
+void tss_set_kernel_stack(uint32_t esp0) {
+    this_cpu()->tss.esp0 = esp0;
+}
+
+
 void PIC_sendEOI(unsigned char irq) {
 	if(irq >= 8) {
 		outb(PIC_2_COMMAND,PIC_EOI);
@@ -215,6 +260,29 @@ void IRQ_clear_mask(unsigned char IRQline) {
     outb(port, value);        
 }
 
+// Controller-neutral IRQ helpers: the I/O APIC once apic_init() has taken
+// over, the 8259s otherwise.
+void irq_eoi(unsigned char irq) {
+    if (apic_enabled)
+        lapic_eoi();
+    else
+        PIC_sendEOI(irq);
+}
+
+void irq_mask(unsigned char irq) {
+    if (apic_enabled)
+        ioapic_mask(irq);
+    else
+        IRQ_set_mask(irq);
+}
+
+void irq_unmask(unsigned char irq) {
+    if (apic_enabled)
+        ioapic_unmask(irq);
+    else
+        IRQ_clear_mask(irq);
+}
+
 void idt_flush(struct idt_ptr *idt){
     asm("lidt %0\n"
         :
@@ -227,7 +295,7 @@ __attribute__((interrupt)) void divide_error_handler(struct interrupt_frame* fra
 {
     asm("cli");
     /* do something */
-    while(1);
+    halt_forever();
 }
 
 __attribute__((interrupt)) void debug_exception_handler(struct interrupt_frame* frame)
@@ -265,11 +333,11 @@ __attribute__((interrupt)) void invalid_opcode_handler(struct interrupt_frame* f
 //    while(1);
 }
 
+// #NM: lazy FPU restore, see fpu.c
 __attribute__((interrupt)) void coprocessor_not_available_handler(struct interrupt_frame* frame)
 {
     asm("cli");
-    /* do something */
-//    while(1);
+    fpu_nm_trap();
 }
 
 __attribute__((interrupt)) void double_fault_handler(struct interrupt_frame* frame)
@@ -317,13 +385,25 @@ void general_protection_handler(struct interrupt_frame* frame)
 {
     asm("cli");
     /* do something */
-    while(1);
+    halt_forever();
 }
-//void page_fault_handler(struct interrupt_frame* frame)
-void page_fault_handler(struct process_context_with_error* ctx)
+__attribute__((interrupt)) void page_fault_handler(struct interrupt_frame* frame, uint32_t error_code)
 {
-    asm("cli");
-    while(1);
+    uint64_t t0 = irqstat_enter();
+    uint32_t fault_addr;
+    asm volatile("mov %%cr2, %0" : "=r"(fault_addr));
+
+    // Demand-zero and copy-on-write faults are resolved and the access retried
+    trace_handler_begin("page_fault", fault_addr);
+    if (vm_handle_page_fault(fault_addr, error_code) == 0) {
+        trace_handler_end("page_fault", fault_addr);
+        irqstat_exit(14, t0);
+        return;
+    }
+
+    // Fatal: report on COM1 without relying on interrupts or locks
+    panic("page fault at 0x%08x, error 0x%x, eip 0x%08x\n",
+          fault_addr, error_code, frame->eip);
 }
 
 
@@ -331,39 +411,93 @@ __attribute__((interrupt)) void coprocessor_error_handler(struct interrupt_frame
 {
     asm("cli");
     /* do something */
-    while(1);
+    halt_forever();
+}
+
+// Entering interrupt context: an idle CPU is awake now, and one that
+// stopped its tick to sleep gets it back before anything reads the clock.
+static void irq_enter(uint8_t vector) {
+    struct cpu *c = this_cpu();
+
+    c->idle = 0;
+    if (c->nohz)
+        timer_nohz_exit(vector == IRQ_TIMER_VECTOR);
+}
+
+// Leaving interrupt context: run the work this IRQ deferred, then preempt
+// if a more urgent thread became runnable or the slice ran out. Never
+// preempt in the middle of a softirq batch we interrupted.
+static void irq_exit(void) {
+    softirq_run();
+    if (!in_softirq())
+        sched_preempt();
+}
+
+// The LAPIC raises this when an interrupt goes away before it is accepted.
+// No EOI must be sent for it.
+IRQ_HANDLER(apic_spurious_handler, APIC_SPURIOUS_VECTOR)
+{
+}
+
+// Sent by sched_kick_cpu() to a halted CPU. Waking it up is the whole
+// job; the idle loop looks for work once the handler returns.
+IRQ_HANDLER(resched_ipi_handler, RESCHED_VECTOR)
+{
+    lapic_eoi();
 }
 
 __attribute__((interrupt)) void stub_isr(struct interrupt_frame* frame)
 {
     asm("cli");
     /* do something */
-    while(1);
+    halt_forever();
 }
 
-__attribute__((interrupt)) void pit_handler(struct interrupt_frame* frame)
+IRQ_HANDLER(pit_handler, IRQ_TIMER_VECTOR)
 {
-    asm("cli");
-    /* do something */
-    while(1);
+    // EOI first so a slow timer callback does not hold off the next tick.
+    // With the APIC enabled this vector is fed by the LAPIC timer instead.
+    irq_eoi(0);
+    // Every CPU's LAPIC timer lands here; only the BSP keeps time.
+    struct cpu *c = this_cpu();
+    c->ticks++;
+    prof_sample(frame);
+    if (c->id == 0)
+        timer_tick();
+    sched_tick();
 }
 
 
-__attribute__((interrupt)) void keyboard_handler(struct interrupt_frame* frame)
+IRQ_HANDLER(keyboard_handler, IRQ_KEYBOARD_VECTOR)
 {
-    asm("cli");
-    /* do something */
-    outb(0x20,0x20);
+    // Reading the data port also lets the controller send the next byte.
+    // If the consumer has fallen behind the scancode is dropped. Decoding
+    // happens later, in keyboard_decode().
+    uint8_t scancode = inb(KEYBOARD_DATA_PORT);
+    scancode_ring_push(&kbd_ring, scancode);
+    work_queue(&keyboard_work);
+    this_cpu()->irq_count++;
+    irq_eoi(1);
 }
 
-
-__attribute__((interrupt)) void syscall_handler(struct interrupt_frame* frame)
+IRQ_HANDLER(serial_handler, IRQ_COM1_VECTOR)
 {
-    asm("cli");
-    /* do something */
-    while(1);
+    serial_interrupt();
+    this_cpu()->irq_count++;
+    irq_eoi(COM1_IRQ);
+}
+
+// Next raw scancode from the keyboard, or -1 if none is queued.
+// Single consumer: keyboard_decode().
+int keyboard_read_scancode(void) {
+    uint8_t scancode;
+    if (scancode_ring_pop(&kbd_ring, &scancode) != 0)
+        return -1;
+    return scancode;
 }
 
+
+
 static void idt_set_gate(uint8_t num, uint32_t base, uint16_t sel, uint8_t flags)
 {
    idt_entries[num].base_lo = base & 0xFFFF;
@@ -376,13 +510,29 @@ static void idt_set_gate(uint8_t num, uint32_t base, uint16_t sel, uint8_t flags
    idt_entries[num].flags   = flags /* | 0x60 */;
 }
 
+/*
+ * Fast system calls. SYSENTER loads CS from the MSR and takes SS = CS + 8;
+ * SYSEXIT returns to CS + 16 and SS + 24 (RPL 3), which is exactly our GDT
+ * order: kernel code, kernel data, user code, user data. The entry stack
+ * MSR points at tss.esp0 so it always follows the current thread. The MSRs
+ * are per CPU, so every CPU calls this with its own TSS.
+ */
+void init_sysenter(struct tss_entry *tss) {
+    uint32_t eax, ebx, ecx, edx;
+
+    cpuid(1, &eax, &ebx, &ecx, &edx);
+    if (!(edx & CPUID_EDX_SEP))
+        return;
+
+    wrmsr(MSR_SYSENTER_CS, 0x08);
+    wrmsr(MSR_SYSENTER_ESP, (uint32_t)&tss->esp0);
+    wrmsr(MSR_SYSENTER_EIP, (uint32_t)sysenter_entry);
+    sysenter_supported = 1;
+}
+
 void init_idt() {
     int i;
 
-
-    extern struct gdt_entry_bits gdt[];
-    write_tss(&gdt[5]);
-
     idt_ptr.limit = sizeof(struct idt_entry) * 256 -1;
     idt_ptr.base  = (uint32_t)&idt_entries;
 
@@ -409,9 +559,17 @@ void init_idt() {
     idt_set_gate(14, (uint32_t)page_fault_handler, 0x08, 0x8e);
 //    idt_set_gate(15, (uint32_t)coprocessor_error_handler, 0x08, 0x8e);
 
-    idt_set_gate(0x21, (uint32_t)keyboard_handler,0x08, 0x8e);
-    idt_set_gate(0x80, (uint32_t)syscall_handler,0x08, 0xee); // Set flags to EE, making DPL = 3 so it is accessible from userspace
-    idt_set_gate(32,   (uint32_t)pit_handler, 0x08, 0x8e);
+    idt_set_gate(IRQ_KEYBOARD_VECTOR, (uint32_t)keyboard_handler,0x08, 0x8e);
+    idt_set_gate(0x80, (uint32_t)syscall_int80_entry,0x08, 0xee); // Set flags to EE, making DPL = 3 so it is accessible from userspace
+    idt_set_gate(IRQ_TIMER_VECTOR, (uint32_t)pit_handler, 0x08, 0x8e);
+    idt_set_gate(IRQ_COM1_VECTOR, (uint32_t)serial_handler, 0x08, 0x8e);
+    idt_set_gate(RESCHED_VECTOR, (uint32_t)resched_ipi_handler, 0x08, 0x8e);
+    idt_set_gate(APIC_SPURIOUS_VECTOR, (uint32_t)apic_spurious_handler, 0x08, 0x8e);
+    idt_flush(&idt_ptr);
+}
+
+// All CPUs share one IDT; APs load it once init_idt() has filled it in.
+void load_idt(void) {
     idt_flush(&idt_ptr);
 }
 
@@ -0,0 +1,144 @@
+#ifndef INTERRUPT_H
+#define INTERRUPT_H
+
+#include <stdint.h>
+#include "io.h"
+
+#define PIC_1_CTRL    0x20
+#define PIC_1_DATA    0x21
+#define PIC_2_CTRL    0xA0
+#define PIC_2_DATA    0xA1
+#define PIC_1_COMMAND PIC_1_CTRL
+#define PIC_2_COMMAND PIC_2_CTRL
+#define PIC_EOI       0x20
+
+// IRQ n arrives on vector IRQ_BASE_VECTOR + n, from the PIC or the I/O APIC
+#define IRQ_BASE_VECTOR     0x20
+#define IRQ_TIMER_VECTOR    (IRQ_BASE_VECTOR + 0)
+#define IRQ_KEYBOARD_VECTOR (IRQ_BASE_VECTOR + 1)
+#define IRQ_COM1_VECTOR     (IRQ_BASE_VECTOR + 4)
+
+// Segment descriptor, laid out bit-for-bit as the CPU expects it in the GDT
+struct gdt_entry_bits {
+    unsigned int limit_low              : 16;
+    unsigned int base_low               : 24;
+    unsigned int accessed               : 1;
+    unsigned int read_write             : 1;
+    unsigned int conforming_expand_down : 1;
+    unsigned int code                   : 1;
+    unsigned int always_1               : 1;
+    unsigned int DPL                    : 2;
+    unsigned int present                : 1;
+    unsigned int limit_high             : 4;
+    unsigned int available              : 1;
+    unsigned int always_0               : 1;
+    unsigned int big                    : 1;
+    unsigned int gran                   : 1;
+    unsigned int base_high              : 8;
+} __attribute__((packed));
+
+// Operand of lgdt
+struct seg_desc {
+    uint16_t sz;
+    uint32_t addr;
+} __attribute__((packed));
+
+// Interrupt gate
+struct idt_entry {
+    uint16_t base_lo;
+    uint16_t sel;
+    uint8_t  always0;
+    uint8_t  flags;
+    uint16_t base_hi;
+} __attribute__((packed));
+
+// Operand of lidt
+struct idt_ptr {
+    uint16_t limit;
+    uint32_t base;
+} __attribute__((packed));
+
+// 32-bit task state segment. We only use it for ss0/esp0 on ring changes.
+struct tss_entry {
+    uint32_t prev_tss;
+    uint32_t esp0;
+    uint32_t ss0;
+    uint32_t esp1;
+    uint32_t ss1;
+    uint32_t esp2;
+    uint32_t ss2;
+    uint32_t cr3;
+    uint32_t eip;
+    uint32_t eflags;
+    uint32_t eax;
+    uint32_t ecx;
+    uint32_t edx;
+    uint32_t ebx;
+    uint32_t esp;
+    uint32_t ebp;
+    uint32_t esi;
+    uint32_t edi;
+    uint32_t es;
+    uint32_t cs;
+    uint32_t ss;
+    uint32_t ds;
+    uint32_t fs;
+    uint32_t gs;
+    uint32_t ldt;
+    uint16_t trap;
+    uint16_t iomap_base;
+} __attribute__((packed));
+
+// What the CPU pushes on interrupt entry (esp/ss only on a ring change)
+struct interrupt_frame {
+    uint32_t eip;
+    uint32_t cs;
+    uint32_t eflags;
+    uint32_t esp;
+    uint32_t ss;
+};
+
+// Page fault error code bits
+#define PF_PRESENT 0x1   // fault on a present page (protection violation)
+#define PF_WRITE   0x2   // faulting access was a write
+#define PF_USER    0x4   // fault happened in ring 3
+
+// Disable interrupts and return the previous EFLAGS for irq_restore()
+static inline uint32_t irq_save(void) {
+    uint32_t flags;
+    __asm__ __volatile__("pushf\n"
+                         "pop %0\n"
+                         "cli"
+                         : "=r"(flags) :: "memory");
+    return flags;
+}
+
+static inline void irq_restore(uint32_t flags) {
+    __asm__ __volatile__("push %0\n"
+                         "popf"
+                         :: "r"(flags) : "memory", "cc");
+}
+
+// Stop this CPU for good without spinning (fatal errors)
+static inline void halt_forever(void) {
+    while (1)
+        __asm__ __volatile__("cli; hlt");
+}
+
+void load_gdt(void);
+void write_tss(struct gdt_entry_bits *g, struct tss_entry *tss, uint32_t esp0);
+void tss_flush(uint16_t tss);
+void tss_set_kernel_stack(uint32_t esp0);
+void init_sysenter(struct tss_entry *tss);
+void init_idt(void);
+void load_idt(void);
+void remap_pic(void);
+void PIC_sendEOI(unsigned char irq);
+void IRQ_set_mask(unsigned char IRQline);
+void IRQ_clear_mask(unsigned char IRQline);
+void irq_eoi(unsigned char irq);
+void irq_mask(unsigned char irq);
+void irq_unmask(unsigned char irq);
+int keyboard_read_scancode(void);
+
+#endif
@@ -0,0 +1,80 @@
+#include <stdint.h>
+#include "irqstat.h"
+#include "interrupt.h"
+#include "smp.h"
+#include "rprintf.h"
+
+#ifdef CONFIG_IRQ_STATS
+struct irq_stat irq_stats[MAX_CPUS][256];
+
+// Charge one handler run, started at t0, to vector on the calling CPU.
+void irqstat_exit(uint8_t vector, uint64_t t0) {
+    uint32_t cycles = (uint32_t)(rdtsc() - t0);
+    struct irq_stat *s = &irq_stats[this_cpu()->id][vector];
+
+    if (s->count == 0 || cycles < s->min)
+        s->min = cycles;
+    if (cycles > s->max)
+        s->max = cycles;
+    s->total += cycles;
+    s->count++;
+}
+
+static const char *vector_name(int vector) {
+    switch (vector) {
+    case 14:                   return "page fault";
+    case IRQ_TIMER_VECTOR:     return "timer";
+    case IRQ_KEYBOARD_VECTOR:  return "keyboard";
+    case APIC_SPURIOUS_VECTOR: return "spurious";
+    default:                   return "";
+    }
+}
+
+/*
+ * Print one line per vector that has fired, summed over all CPUs: how
+ * often, and the min/avg/max cycles its handler took. A huge count points
+ * at an interrupt storm, a huge max at a slow handler.
+ */
+void irqstat_dump(void) {
+    printk("vec      count      min      avg      max  name\n");
+    for (int v = 0; v < 256; v++) {
+        struct irq_stat sum = { 0, 0xFFFFFFFF, 0, 0 };
+
+        for (uint32_t c = 0; c < cpus_online; c++) {
+            struct irq_stat *s = &irq_stats[c][v];
+            if (s->count == 0)
+                continue;
+            sum.count += s->count;
+            sum.total += s->total;
+            if (s->min < sum.min)
+                sum.min = s->min;
+            if (s->max > sum.max)
+                sum.max = s->max;
+        }
+        if (sum.count == 0)
+            continue;
+        printk("0x%02x %10d %8d %8d %8d  %s\n", v, sum.count, sum.min,
+                   div64_32(sum.total, sum.count), sum.max, vector_name(v));
+    }
+}
+
+void irqstat_reset(void) {
+    uint32_t flags = irq_save();
+    for (int c = 0; c < MAX_CPUS; c++) {
+        for (int v = 0; v < 256; v++) {
+            irq_stats[c][v].count = 0;
+            irq_stats[c][v].min = 0;
+            irq_stats[c][v].max = 0;
+            irq_stats[c][v].total = 0;
+        }
+    }
+    irq_restore(flags);
+}
+#else
+void irqstat_dump(void) {
+    printk("IRQ statistics not built in (CONFIG_IRQ_STATS)\n");
+}
+
+void irqstat_reset(void) {
+}
+#endif
@@ -0,0 +1,40 @@
+#ifndef IRQSTAT_H
+#define IRQSTAT_H
+
+#include <stdint.h>
+#include "timing.h"
+#include "apic.h"
+
+/*
+ * Per-vector interrupt counts and handler times in TSC cycles, kept per
+ * CPU so handlers never share a cache line. Built with CONFIG_IRQ_STATS;
+ * without it irqstat_enter()/irqstat_exit() compile to nothing.
+ */
+struct irq_stat {
+    uint32_t count;
+    uint32_t min;
+    uint32_t max;
+    uint64_t total;
+};
+
+#ifdef CONFIG_IRQ_STATS
+extern struct irq_stat irq_stats[MAX_CPUS][256];
+
+static inline uint64_t irqstat_enter(void) {
+    return rdtsc();
+}
+
+void irqstat_exit(uint8_t vector, uint64_t t0);
+#else
+static inline uint64_t irqstat_enter(void) {
+    return 0;
+}
+
+static inline void irqstat_exit(uint8_t vector, uint64_t t0) {
+}
+#endif
+
+void irqstat_dump(void);
+void irqstat_reset(void);
+
+#endif
@@ -4,57 +4,30 @@
 #include "page.h"
 #include "paging.h"
 #include "fat.h"
+#include "interrupt.h"
+#include "vm.h"
+#include "timer.h"
+#include "thread.h"
+#include "apic.h"
+#include "smp.h"
+#include "bench.h"
+#include "monitor.h"
+#include "serial.h"
+#include "prof.h"
+#include "console.h"
+#include "dmesg.h"
+#include "lib/string.h"
+#include "lib/checksum.h"
+#include "lib/simd.h"
+#include "fpu.h"
+#include "timing.h"
+#include "trace.h"
 
 #define MULTIBOOT2_HEADER_MAGIC 0xe85250d6
 
 const unsigned int multiboot_header[] __attribute__((section(".multiboot"))) =
     {MULTIBOOT2_HEADER_MAGIC, 0, 16, -(16 + MULTIBOOT2_HEADER_MAGIC), 0, 12};
 
-#define VGA_ADDRESS 0xB8000
-#define VGA_COLS 80
-#define VGA_ROWS 25
-
-struct termbuf {
-    char ascii;
-    char color;
-};
-
-static struct termbuf* const vram = (struct termbuf*)VGA_ADDRESS;
-int x = 0;
-int y = 0;
-
-void scroll() {
-    for (int row = 1; row < VGA_ROWS; row++) {
-        for (int col = 0; col < VGA_COLS; col++) {
-            vram[(row - 1) * VGA_COLS + col] = vram[row * VGA_COLS + col];
-        }
-    }
-    for (int col = 0; col < VGA_COLS; col++) {
-        vram[(VGA_ROWS - 1) * VGA_COLS + col].ascii = ' ';
-        vram[(VGA_ROWS - 1) * VGA_COLS + col].color = 7;
-    }
-}
-
-int putc(int data) {
-    if (data == '\n') {
-        x = 0;
-        y++;
-    } else {
-        vram[y * VGA_COLS + x].ascii = (char)data;
-        vram[y * VGA_COLS + x].color = 7;
-        x++;
-        if (x >= VGA_COLS) {
-            x = 0;
-            y++;
-        }
-    }
-    if (y >= VGA_ROWS) {
-        scroll();
-        y = VGA_ROWS - 1;
-    }
-    return 0;
-}
-
 extern struct page_directory_entry pd[1024];
 
 void identity_map_kernel_and_stack_and_vga() {
@@ -64,110 +37,428 @@ void identity_map_kernel_and_stack_and_vga() {
     extern unsigned int _end_kernel;
     uint32_t kernel_end = (uint32_t)&_end_kernel;
 
-    for (uint32_t addr = 0x100000; addr < kernel_end; addr += 0x1000) {
-        tmp.physical_addr = (void *)addr;
-        map_pages((void *)addr, &tmp, pd);
-    }
+    // Low memory (including VGA at 0xB8000), the kernel image and the page
+    // frame pool, rounded up to whole 4 MiB pages so the kernel runs from a
+    // handful of TLB entries.
+    uint32_t kernel_span = (kernel_end + PAGE_SIZE_4M - 1) & ~(PAGE_SIZE_4M - 1);
+    if (kernel_span < PFA_END)
+        kernel_span = PFA_END;
+    map_region(0, 0, kernel_span, pd);
+    map_recursive(pd);
 
+    // The boot stack only needs 4 KiB pages if it lives outside that range.
     uint32_t esp;
     asm volatile("mov %%esp, %0" : "=r"(esp));
     for (uint32_t addr = (esp & 0xFFFFF000); addr >= esp - 0x8000; addr -= 0x1000) {
+        if (addr < kernel_span)
+            break;
         tmp.physical_addr = (void *)addr;
         map_pages((void *)addr, &tmp, pd);
     }
-
-    tmp.physical_addr = (void *)0xB8000;
-    map_pages((void *)0xB8000, &tmp, pd);
 }
 
 void test_fat_driver() {
-    esp_printf((func_ptr)putc, "\n\n=== Testing FAT Filesystem Driver ===\n\n");
+    printk("\n\n=== Testing FAT Filesystem Driver ===\n\n");
 
-    esp_printf((func_ptr)putc, "Calling fatInit()...\n");
+    printk("Calling fatInit()...\n");
+    uint64_t t0 = rdtsc();
     int init_result = fatInit();
+    bench_phase("fat_init", t0);
     if (init_result != 0) {
-        esp_printf((func_ptr)putc, "FAILED: Could not initialize FAT filesystem.\n");
-        esp_printf((func_ptr)putc, "Error code: %d\n", init_result);
+        printk("FAILED: Could not initialize FAT filesystem.\n");
+        printk("Error code: %d\n", init_result);
         if (init_result == -1) {
-            esp_printf((func_ptr)putc, "  -> Boot sector read failed (ata_lba_read error)\n");
-            esp_printf((func_ptr)putc, "  -> Check if IDE driver is working\n");
+            printk("  -> Boot sector read failed (ata_lba_read error)\n");
+            printk("  -> Check if IDE driver is working\n");
         } else if (init_result == -2) {
-            esp_printf((func_ptr)putc, "  -> Boot signature invalid (not 0xAA55)\n");
-            esp_printf((func_ptr)putc, "  -> FAT filesystem may not be at sector 2048\n");
+            printk("  -> Boot signature invalid (not 0xAA55)\n");
+            printk("  -> FAT filesystem may not be at sector 2048\n");
         } else if (init_result == -3) {
-            esp_printf((func_ptr)putc, "  -> FAT table read failed\n");
+            printk("  -> FAT table read failed\n");
         } else if (init_result == -4) {
-            esp_printf((func_ptr)putc, "  -> Root directory read failed\n");
+            printk("  -> Root directory read failed\n");
         }
-        esp_printf((func_ptr)putc, "Make sure rootfs.img was built and mounted properly.\n");
+        printk("Make sure rootfs.img was built and mounted properly.\n");
         return;
     }
-    esp_printf((func_ptr)putc, "fatInit() successful.\n\n");
+    printk("fatInit() successful.\n\n");
 
-    esp_printf((func_ptr)putc, "Calling fatOpen(\"testfile.txt\")...\n");
+    printk("Calling fatOpen(\"testfile.txt\")...\n");
     struct file *f = fatOpen("testfile.txt");
     if (!f) {
-        esp_printf((func_ptr)putc, "FAILED: File not found.\n");
-        esp_printf((func_ptr)putc, "Make sure testfile.txt is in the root directory.\n");
-        esp_printf((func_ptr)putc, "Run: sudo mdir -i rootfs.img@@1M ::/ to verify\n");
+        printk("FAILED: File not found.\n");
+        printk("Make sure testfile.txt is in the root directory.\n");
+        printk("Run: sudo mdir -i rootfs.img@@1M ::/ to verify\n");
         return;
     }
-    esp_printf((func_ptr)putc, "fatOpen() successful.\n");
-    esp_printf((func_ptr)putc, "File size: %d bytes\n", f->rde.file_size);
-    esp_printf((func_ptr)putc, "Start cluster: %d\n\n", f->start_cluster);
+    printk("fatOpen() successful.\n");
+    printk("File size: %d bytes\n", f->rde.file_size);
+    printk("Start cluster: %d\n\n", f->start_cluster);
 
-    esp_printf((func_ptr)putc, "Calling fatRead()...\n");
+    printk("Calling fatRead()...\n");
     char buffer[512];
     int bytes_read = fatRead(f, buffer, sizeof(buffer) - 1);
+    fatClose(f);
     if (bytes_read < 0) {
-        esp_printf((func_ptr)putc, "FAILED: Could not read file contents.\n");
+        printk("FAILED: Could not read file contents.\n");
         return;
     }
     buffer[bytes_read] = '\0';
-    esp_printf((func_ptr)putc, "fatRead() successful. Read %d bytes.\n\n", bytes_read);
-
-    esp_printf((func_ptr)putc, "Displaying file contents:\n");
-    esp_printf((func_ptr)putc, "========================================\n");
-    esp_printf((func_ptr)putc, "%s", buffer);
-    if (buffer[bytes_read - 1] != '\n') esp_printf((func_ptr)putc, "\n");
-    esp_printf((func_ptr)putc, "========================================\n");
-    esp_printf((func_ptr)putc, "\nAll FAT driver deliverables completed successfully!\n");
+    printk("fatRead() successful. Read %d bytes.\n\n", bytes_read);
+
+    printk("Displaying file contents:\n");
+    printk("========================================\n");
+    printk("%s", buffer);
+    if (buffer[bytes_read - 1] != '\n') printk("\n");
+    printk("========================================\n");
+    printk("\nAll FAT driver deliverables completed successfully!\n");
+}
+
+void test_cow_fork() {
+    printk("\n=== Testing copy-on-write fork ===\n");
+
+    uint32_t *page = (uint32_t *)0x80000000;
+    struct address_space *parent = as_create();
+    if (!parent || as_map_user_page(parent, page, 1) != 0) {
+        printk("FAILED: Could not create parent address space.\n");
+        return;
+    }
+    as_switch(parent);
+    page[0] = 1234;
+
+    struct address_space *child = as_fork(parent);
+    if (!child) {
+        printk("FAILED: as_fork() returned NULL.\n");
+        as_switch(&kernel_address_space);
+        as_destroy(parent);
+        return;
+    }
+
+    as_switch(child);
+    page[0] = 5678;   // write fault gives the child a private copy
+    uint32_t child_val = page[0];
+    as_switch(parent);
+    uint32_t parent_val = page[0];
+    as_switch(&kernel_address_space);
+
+    printk("Parent sees %d, child sees %d\n", parent_val, child_val);
+    if (parent_val == 1234 && child_val == 5678)
+        printk("Copy-on-write fork works.\n");
+    else
+        printk("FAILED: pages were not copied on write.\n");
+
+    as_destroy(child);
+    as_destroy(parent);
+}
+
+// Reserved pages must read back as zeroes on first touch, whether the
+// frame came from the zeroed pool or was cleared on the spot.
+void test_demand_zero() {
+    printk("\n=== Testing demand-zero pages ===\n");
+
+    uint32_t *page = (uint32_t *)0x80000000;
+    int failures = 0;
+
+    for (int pass = 0; pass < 2; pass++) {
+        zero_pool_enable(pass == 0);
+        struct address_space *as = as_create();
+        if (!as || as_reserve_user_page(as, page, 1) != 0) {
+            printk("FAILED: Could not reserve a demand-zero page.\n");
+            zero_pool_enable(1);
+            return;
+        }
+        as_switch(as);
+        for (int i = 0; i < 1024; i++) {
+            if (page[i] != 0)
+                failures++;
+        }
+        page[0] = 0xDEADBEEF;   // dirty the frame for whoever gets it next
+        as_switch(&kernel_address_space);
+        as_destroy(as);
+    }
+    zero_pool_enable(1);
+
+    if (failures)
+        printk("FAILED: %d non-zero words in demand-zero pages.\n", failures);
+    else
+        printk("Demand-zero pages work (pool %d frames, %d hits, %d misses).\n",
+               zero_pool_count(), zero_pool_hits, zero_pool_misses);
+}
+
+#define STRTEST_MAX  300
+#define SIMDTEST_MAX (4096 + SIMD_BLOCK)
+#define STRTEST_BUF  (SIMDTEST_MAX + 32)
+
+static uint8_t strtest_a[STRTEST_BUF], strtest_b[STRTEST_BUF];
+static uint8_t strtest_ref[STRTEST_BUF];
+
+// Fill or compare the first len bytes; callers pass a bit more than n
+static void strtest_fill(uint8_t *buf, uint32_t seed, int len) {
+    for (int i = 0; i < len; i++) {
+        buf[i] = (uint8_t)(seed + i * 131 + 1);
+    }
+}
+
+static int strtest_same(int len) {
+    for (int i = 0; i < len; i++) {
+        if (strtest_a[i] != strtest_ref[i])
+            return 0;
+    }
+    return 1;
+}
+
+// Check lib/string.c against byte loops for every length up to
+// STRTEST_MAX at every alignment, overlapping moves included.
+void test_string_lib(void) {
+    int failures = 0;
+
+    for (int n = 0; n <= STRTEST_MAX; n++) {
+        for (int da = 0; da < 4; da++) {
+            for (int sa = 0; sa < 4; sa++) {
+                // memcpy between separate buffers
+                strtest_fill(strtest_a, n, STRTEST_MAX + 16);
+                strtest_fill(strtest_ref, n, STRTEST_MAX + 16);
+                strtest_fill(strtest_b, n + 7, STRTEST_MAX + 16);
+                memcpy(strtest_a + da, strtest_b + sa, n);
+                for (int i = 0; i < n; i++)
+                    strtest_ref[da + i] = strtest_b[sa + i];
+                failures += !strtest_same(STRTEST_MAX + 16);
+
+                // memmove within one buffer, both directions
+                int d = da * 3, s = sa * 5;
+                strtest_fill(strtest_a, n, STRTEST_MAX + 16);
+                strtest_fill(strtest_ref, n, STRTEST_MAX + 16);
+                memmove(strtest_a + d, strtest_a + s, n);
+                if (d < s) {
+                    for (int i = 0; i < n; i++)
+                        strtest_ref[d + i] = strtest_ref[s + i];
+                } else {
+                    for (int i = n - 1; i >= 0; i--)
+                        strtest_ref[d + i] = strtest_ref[s + i];
+                }
+                failures += !strtest_same(STRTEST_MAX + 16);
+
+                // memcmp: equal copies, then the last byte made to differ
+                for (int i = 0; i < n; i++)
+                    strtest_b[sa + i] = strtest_ref[da + i];
+                if (memcmp(strtest_ref + da, strtest_b + sa, n) != 0)
+                    failures++;
+                if (n > 0) {
+                    uint8_t x = strtest_ref[da + n - 1], y = x ^ 0x80;
+                    strtest_b[sa + n - 1] = y;
+                    int r = memcmp(strtest_ref + da, strtest_b + sa, n);
+                    if ((x < y && r >= 0) || (x > y && r <= 0))
+                        failures++;
+                }
+            }
+
+            // memset
+            strtest_fill(strtest_a, n, STRTEST_MAX + 16);
+            strtest_fill(strtest_ref, n, STRTEST_MAX + 16);
+            memset(strtest_a + da, 0xA5, n);
+            for (int i = 0; i < n; i++)
+                strtest_ref[da + i] = 0xA5;
+            failures += !strtest_same(STRTEST_MAX + 16);
+
+            // strlen
+            for (int i = 0; i < n; i++)
+                strtest_a[da + i] = 'x';
+            strtest_a[da + n] = 0;
+            if (strlen((char *)strtest_a + da) != n)
+                failures++;
+        }
+    }
+
+    if (failures)
+        printk("FAILED: string library, %d mismatches\n", failures);
+    else
+        printk("String library self-test passed.\n");
+}
+
+/*
+ * The SSE2 paths of memcpy(), memset() and fletcher_update() only run from
+ * SIMD_MIN_SIZE up, which test_string_lib() never reaches. Check them
+ * against byte loops at every destination alignment, for every bulk/tail
+ * split just above the cutoff and around 4 KiB, and a sparser sweep in
+ * between. The sources sit at two offsets per destination so every odd
+ * relative misalignment is covered, as well as none.
+ */
+void test_simd_paths(void) {
+    int failures = 0;
+
+    for (int n = SIMD_MIN_SIZE - 1; n <= SIMDTEST_MAX;) {
+        int len = n + 32;
+
+        for (int da = 0; da < 16; da++) {
+            int srcs[2] = { da, 15 - da };
+
+            for (int k = 0; k < 2; k++) {
+                int sa = srcs[k];
+                strtest_fill(strtest_a, n, len);
+                strtest_fill(strtest_ref, n, len);
+                strtest_fill(strtest_b, n + 7, len);
+                memcpy(strtest_a + da, strtest_b + sa, n);
+                for (int i = 0; i < n; i++)
+                    strtest_ref[da + i] = strtest_b[sa + i];
+                failures += !strtest_same(len);
+            }
+
+            strtest_fill(strtest_a, n, len);
+            strtest_fill(strtest_ref, n, len);
+            memset(strtest_a + da, 0x5A, n);
+            for (int i = 0; i < n; i++)
+                strtest_ref[da + i] = 0x5A;
+            failures += !strtest_same(len);
+
+            // Non-zero seeds so the carried-in sums are exercised too
+            uint32_t a = n, b = da * 0x01010101, ra = a, rb = b;
+            strtest_fill(strtest_b, n * 3 + da, len);
+            fletcher_update(&a, &b, strtest_b + da, n);
+            for (int i = 0; i < n; i++) {
+                ra += strtest_b[da + i];
+                rb += ra;
+            }
+            failures += a != ra || b != rb;
+        }
+
+        if (n < SIMD_MIN_SIZE + SIMD_BLOCK || n >= 4096 - 1)
+            n++;
+        else if (n + 61 < 4096 - 1)
+            n += 61;
+        else
+            n = 4096 - 1;
+    }
+
+    if (failures)
+        printk("FAILED: SIMD string/checksum paths, %d mismatches\n", failures);
+    else
+        printk("SIMD string/checksum self-test passed (%s).\n",
+               cpu_has_sse2 ? "SSE2" : "no SSE2, scalar only");
+}
+
+// Every CPU the MADT lists should have come up and checked in.
+void test_smp_checkin(void) {
+    int online = smp_boot_aps();
+    int expected = apic_enabled ? num_cpus : 1;
+
+    printk("SMP: %d of %d CPU(s) checked in\n", online, expected);
+    for (int i = 0; i < online; i++) {
+        printk("  cpu%d: APIC ID %d\n", cpus[i].id, cpus[i].apic_id);
+    }
+    if (online != expected)
+        printk("FAILED: not every CPU started.\n");
 }
 
 void main() {
+    extern int _end_stack;
+
+    load_gdt();
+    init_idt();
+    cpu_init(&cpus[0], (uint32_t)&_end_stack);
+    fpu_init();
+    remap_pic();
+    serial_init();
+    console_init();
+
+    uint64_t t0 = rdtsc();
     init_pfa_list();
-    esp_printf((func_ptr)putc, "Free page list initialized.\n");
+    bench_phase("pfa", t0);
+    printk("Free page list initialized.\n");
 
     struct ppage *allocated = allocate_physical_pages(3);
     if (!allocated) {
-        esp_printf((func_ptr)putc, "Page allocation failed!\n");
-        while (1);
+        printk("Page allocation failed!\n");
+        dmesg_flush();
+        halt_forever();
     }
 
     struct ppage *curr = allocated;
     int i = 1;
     while (curr) {
-        esp_printf((func_ptr)putc, "Allocated page %d at: 0x%x\n", i, curr->physical_addr);
+        printk("Allocated page %d at: 0x%x\n", i, curr->physical_addr);
         curr = curr->next;
         i++;
     }
 
     free_physical_pages(allocated);
-    esp_printf((func_ptr)putc, "Freed pages back to free list.\n");
+    printk("Freed pages back to free list.\n");
 
     struct ppage *single = allocate_physical_pages(1);
-    esp_printf((func_ptr)putc, "Allocated single page at: 0x%x\n", single->physical_addr);
+    printk("Allocated single page at: 0x%x\n", single->physical_addr);
 
-    esp_printf((func_ptr)putc, "\nSetting up paging...\n");
+    printk("\nSetting up paging...\n");
+    t0 = rdtsc();
     identity_map_kernel_and_stack_and_vga();
 
-    esp_printf((func_ptr)putc, "Loading page directory...\n");
+    printk("Loading page directory...\n");
     loadPageDirectory(pd);
 
-    esp_printf((func_ptr)putc, "Enabling paging...\n");
-    esp_printf((func_ptr)putc, "Paging enabled successfully!\n");
+    printk("Enabling paging...\n");
+    enable_pse();
+    enable_paging();
+    enable_global_pages();
+    bench_phase("paging", t0);
+    printk("Paging enabled successfully!\n");
+    vm_init();
+
+    t0 = rdtsc();
+    timer_init(CONFIG_TIMER_HZ);
+    bench_phase("timer", t0);
+    t0 = rdtsc();
+    int apic_ok = apic_init() == 0;
+    bench_phase("apic", t0);
+    if (apic_ok)
+        printk("Using local/IO APIC, %d CPU(s) found\n", num_cpus);
+    else
+        printk("No usable APIC, staying on the 8259 PIC\n");
+    serial_irq_init();
+    sched_init();
+    t0 = rdtsc();
+    test_smp_checkin();
+    bench_phase("smp", t0);
+    asm volatile("sti");
+    dmesg_start();
+    zero_pool_start();
+    printk("Timer running at %d Hz, TSC %d kHz\n", CONFIG_TIMER_HZ, tsc_khz);
+#ifdef CONFIG_PROFILE
+    prof_start(PROF_HZ_DEFAULT);
+#endif
+#ifdef CONFIG_TRACE_BOOT
+    trace_start();
+#endif
+
+#ifdef CONFIG_BENCH
+    bench_paging();
+    bench_map_unmap();
+    bench_cr3_switch();
+    bench_timer_wheel();
+    bench_context_switch();
+    bench_console();
+    bench_string();
+    bench_parallel_checksum();
+    bench_syscall();
+    bench_fault_zero();
+#endif
 
     test_fat_driver();
+    test_cow_fork();
+    test_demand_zero();
+    test_string_lib();
+    test_simd_paths();
+#ifdef CONFIG_PROFILE
+    prof_stop();
+    prof_dump();
+#endif
+#ifdef CONFIG_TRACE_BOOT
+    trace_stop();
+    trace_dump();
+#endif
+#ifdef CONFIG_BENCH
+    bench_boot_phases();
+    bench_exit(0);
+#endif
+    monitor_start();
 
-    while (1);
+    // Everything else runs in threads now; leave the BSP to its idle loop
+    thread_exit();
 }
@@ -0,0 +1,95 @@
+#include <stdint.h>
+#include "keyboard.h"
+#include "interrupt.h"
+#include "ring.h"
+#include "event.h"
+
+// Scancode set 1
+#define SC_LSHIFT    0x2A
+#define SC_RSHIFT    0x36
+#define SC_CAPSLOCK  0x3A
+#define SC_RELEASE   0x80
+#define SC_EXTENDED  0xE0
+
+SPSC_RING_DECLARE(char_ring, char, 7)
+
+// Filled by keyboard_decode(), drained by keyboard_getc()
+static struct char_ring chars;
+static struct event chars_event;   // signalled when chars gains something
+static int shift;
+static int capslock;
+static int extended;
+
+static const char keymap[0x3A] = {
+    0,   27,  '1', '2', '3', '4', '5', '6', '7', '8', '9', '0', '-', '=', '\b',
+    '\t', 'q', 'w', 'e', 'r', 't', 'y', 'u', 'i', 'o', 'p', '[', ']', '\n',
+    0,   'a', 's', 'd', 'f', 'g', 'h', 'j', 'k', 'l', ';', '\'', '`',
+    0,   '\\', 'z', 'x', 'c', 'v', 'b', 'n', 'm', ',', '.', '/', 0,
+    '*', 0,   ' ',
+};
+
+static const char keymap_shift[0x3A] = {
+    0,   27,  '!', '@', '#', '$', '%', '^', '&', '*', '(', ')', '_', '+', '\b',
+    '\t', 'Q', 'W', 'E', 'R', 'T', 'Y', 'U', 'I', 'O', 'P', '{', '}', '\n',
+    0,   'A', 'S', 'D', 'F', 'G', 'H', 'J', 'K', 'L', ':', '"', '~',
+    0,   '|', 'Z', 'X', 'C', 'V', 'B', 'N', 'M', '<', '>', '?', 0,
+    '*', 0,   ' ',
+};
+
+/*
+ * Turn the raw scancodes queued by the IRQ handler into characters. Runs
+ * as deferred work with interrupts enabled, never in the hard IRQ; it is
+ * the only consumer of the scancode ring. Keys without an ASCII meaning
+ * (arrows, function keys) are dropped.
+ */
+void keyboard_decode(void) {
+    int sc, pushed = 0;
+
+    while ((sc = keyboard_read_scancode()) >= 0) {
+        if (sc == SC_EXTENDED) {
+            extended = 1;
+            continue;
+        }
+        if (extended) {
+            extended = 0;
+            continue;
+        }
+
+        int released = sc & SC_RELEASE;
+        sc &= ~SC_RELEASE;
+        if (sc == SC_LSHIFT || sc == SC_RSHIFT) {
+            shift = !released;
+            continue;
+        }
+        if (released || sc >= (int)sizeof(keymap))
+            continue;
+        if (sc == SC_CAPSLOCK) {
+            capslock = !capslock;
+            continue;
+        }
+
+        char c = shift ? keymap_shift[sc] : keymap[sc];
+        if (capslock && c >= 'a' && c <= 'z')
+            c -= 'a' - 'A';
+        else if (capslock && c >= 'A' && c <= 'Z')
+            c += 'a' - 'A';
+        if (c && char_ring_push(&chars, c) == 0)   // dropped if nobody is reading
+            pushed = 1;
+    }
+    if (pushed)
+        event_signal(&chars_event);
+}
+
+// Next decoded character, or -1 if none. Single consumer.
+int keyboard_getc(void) {
+    char c;
+    if (char_ring_pop(&chars, &c) != 0)
+        return -1;
+    return (unsigned char)c;
+}
+
+// Block until keyboard_decode() has queued a character. Single consumer,
+// like keyboard_getc(); may return with nothing queued, so loop on getc.
+void keyboard_wait(void) {
+    event_wait(&chars_event);
+}
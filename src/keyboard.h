@@ -0,0 +1,8 @@
+#ifndef KEYBOARD_H
+#define KEYBOARD_H
+
+void keyboard_decode(void);
+int keyboard_getc(void);
+void keyboard_wait(void);
+
+#endif
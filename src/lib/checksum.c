@@ -0,0 +1,31 @@
+#include <stdint.h>
+#include "checksum.h"
+#include "simd.h"
+#include "../fpu.h"
+
+/*
+ * Fletcher-style running sums over buf: for each byte, a += byte and then
+ * b += a. Both wrap mod 2^32. Large buffers take the SSE2 path when the
+ * CPU has it, with identical results.
+ */
+void fletcher_update(uint32_t *a, uint32_t *b, const void *buf, size_t n) {
+    const uint8_t *p = buf;
+    uint32_t sa, sb;
+
+#ifdef CONFIG_SSE
+    if (n >= SIMD_MIN_SIZE && cpu_has_sse2) {
+        size_t bulk = n & ~(SIMD_BLOCK - 1);
+        fletcher_sse2(a, b, p, bulk);
+        p += bulk;
+        n -= bulk;
+    }
+#endif
+    sa = *a;
+    sb = *b;
+    for (size_t i = 0; i < n; i++) {
+        sa += p[i];
+        sb += sa;
+    }
+    *a = sa;
+    *b = sb;
+}
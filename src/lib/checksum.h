@@ -0,0 +1,8 @@
+#ifndef LIB_CHECKSUM_H
+#define LIB_CHECKSUM_H
+
+#include "string.h"
+
+void fletcher_update(uint32_t *a, uint32_t *b, const void *buf, size_t n);
+
+#endif
@@ -0,0 +1,108 @@
+#include <stdint.h>
+#include "simd.h"
+#include "../fpu.h"
+
+#ifdef CONFIG_SSE
+
+/*
+ * The kernel is compiled with -mgeneral-regs-only, so the compiler neither
+ * uses the XMM registers nor accepts them in asm clobber lists. Each loop
+ * is therefore one asm statement that owns xmm0-xmm7 for its duration.
+ */
+
+// Unaligned loads, aligned stores, 64 bytes per iteration.
+void copy_sse2(void *dst, const void *src, size_t n) {
+    kernel_fpu_begin();
+    __asm__ __volatile__("1:\n"
+                         "movdqu   (%1), %%xmm0\n"
+                         "movdqu 16(%1), %%xmm1\n"
+                         "movdqu 32(%1), %%xmm2\n"
+                         "movdqu 48(%1), %%xmm3\n"
+                         "movdqa %%xmm0,   (%0)\n"
+                         "movdqa %%xmm1, 16(%0)\n"
+                         "movdqa %%xmm2, 32(%0)\n"
+                         "movdqa %%xmm3, 48(%0)\n"
+                         "add $64, %0\n"
+                         "add $64, %1\n"
+                         "sub $64, %2\n"
+                         "jnz 1b"
+                         : "+r"(dst), "+r"(src), "+r"(n)
+                         :: "memory", "cc");
+    kernel_fpu_end();
+}
+
+void set_sse2(void *dst, uint32_t pattern, size_t n) {
+    kernel_fpu_begin();
+    __asm__ __volatile__("movd %2, %%xmm0\n"
+                         "pshufd $0, %%xmm0, %%xmm0\n"
+                         "1:\n"
+                         "movdqa %%xmm0,   (%0)\n"
+                         "movdqa %%xmm0, 16(%0)\n"
+                         "movdqa %%xmm0, 32(%0)\n"
+                         "movdqa %%xmm0, 48(%0)\n"
+                         "add $64, %0\n"
+                         "sub $64, %1\n"
+                         "jnz 1b"
+                         : "+r"(dst), "+r"(n)
+                         : "r"(pattern)
+                         : "memory", "cc");
+    kernel_fpu_end();
+}
+
+// Byte weights for the b sum of one 16-byte block, see fletcher_sse2()
+static const uint16_t fletcher_weights[16] __attribute__((aligned(16))) = {
+    16, 15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1,
+};
+
+/*
+ * Same result as the byte loop a += x; b += a, 16 bytes at a time. For a
+ * block x0..x15, a grows by the byte sum S and b by 16a + sum((16-i)xi).
+ * Over the whole buffer the 16a terms add up to 16 * (blocks * a0 + sum of
+ * the S of all earlier blocks), so the loop keeps three vector sums:
+ * xmm1 = sum of S (psadbw), xmm2 = running sum of xmm1 before each block,
+ * xmm3 = sum of the weighted bytes (pmaddwd). All arithmetic is mod 2^32
+ * in every lane, like the scalar version.
+ */
+void fletcher_sse2(uint32_t *a, uint32_t *b, const void *buf, size_t n) {
+    uint32_t sums[12];
+    uint32_t blocks = n / 16;
+
+    kernel_fpu_begin();
+    __asm__ __volatile__("pxor %%xmm0, %%xmm0\n"
+                         "pxor %%xmm1, %%xmm1\n"
+                         "pxor %%xmm2, %%xmm2\n"
+                         "pxor %%xmm3, %%xmm3\n"
+                         "movdqa   (%3), %%xmm4\n"
+                         "movdqa 16(%3), %%xmm5\n"
+                         "1:\n"
+                         "movdqu (%0), %%xmm6\n"
+                         "paddd %%xmm1, %%xmm2\n"
+                         "movdqa %%xmm6, %%xmm7\n"
+                         "psadbw %%xmm0, %%xmm7\n"
+                         "paddd %%xmm7, %%xmm1\n"
+                         "movdqa %%xmm6, %%xmm7\n"
+                         "punpcklbw %%xmm0, %%xmm6\n"
+                         "punpckhbw %%xmm0, %%xmm7\n"
+                         "pmaddwd %%xmm4, %%xmm6\n"
+                         "pmaddwd %%xmm5, %%xmm7\n"
+                         "paddd %%xmm6, %%xmm3\n"
+                         "paddd %%xmm7, %%xmm3\n"
+                         "add $16, %0\n"
+                         "dec %1\n"
+                         "jnz 1b\n"
+                         "movdqu %%xmm1,   (%2)\n"   // stack may not be 16-aligned
+                         "movdqu %%xmm2, 16(%2)\n"
+                         "movdqu %%xmm3, 32(%2)\n"
+                         : "+r"(buf), "+r"(blocks)
+                         : "r"(sums), "r"(fletcher_weights)
+                         : "memory", "cc");
+    kernel_fpu_end();
+
+    uint32_t s1 = sums[0] + sums[1] + sums[2] + sums[3];
+    uint32_t ps = sums[4] + sums[5] + sums[6] + sums[7];
+    uint32_t s2 = sums[8] + sums[9] + sums[10] + sums[11];
+    *b += 16 * (n / 16) * *a + 16 * ps + s2;
+    *a += s1;
+}
+
+#endif
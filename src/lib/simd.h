@@ -0,0 +1,19 @@
+#ifndef LIB_SIMD_H
+#define LIB_SIMD_H
+
+#include "string.h"
+
+/*
+ * SSE2 inner loops behind memcpy(), memset() and fletcher_update(). Each
+ * one wraps itself in kernel_fpu_begin()/kernel_fpu_end(). Callers check
+ * cpu_has_sse2 and handle alignment and leftovers; n is a non-zero
+ * multiple of SIMD_BLOCK.
+ */
+#define SIMD_BLOCK     64
+#define SIMD_MIN_SIZE  512   // below this the FPU bracket costs more than it saves
+
+void copy_sse2(void *dst, const void *src, size_t n);      // dst 16-byte aligned
+void set_sse2(void *dst, uint32_t pattern, size_t n);      // dst 16-byte aligned
+void fletcher_sse2(uint32_t *a, uint32_t *b, const void *buf, size_t n);
+
+#endif
@@ -0,0 +1,143 @@
+#include <stdint.h>
+#include "string.h"
+#include "simd.h"
+#include "../fpu.h"
+
+// Word loads through a type the optimiser will not assume disjoint from char
+typedef uint32_t __attribute__((may_alias)) word_t;
+
+#define ONES   0x01010101u
+#define HIGHS  0x80808080u
+
+// Below this the setup for aligning is not worth it
+#define ALIGN_THRESHOLD 16
+
+static inline void movsb(void **d, const void **s, size_t n) {
+    __asm__ __volatile__("rep movsb" : "+D"(*d), "+S"(*s), "+c"(n) :: "memory");
+}
+
+static inline void movsl(void **d, const void **s, size_t n) {
+    __asm__ __volatile__("rep movsl" : "+D"(*d), "+S"(*s), "+c"(n) :: "memory");
+}
+
+/*
+ * Byte moves up to a 4-byte aligned destination, rep movsd for the bulk,
+ * then the 0-3 byte tail. An aligned destination matters more than an
+ * aligned source: misaligned stores split into two bus cycles, and CPUs
+ * with fast strings only use them when the destination is aligned.
+ */
+void *memcpy(void *dst, const void *src, size_t n) {
+    void *d = dst;
+
+#ifdef CONFIG_SSE
+    // Large copies: same, but the bulk goes through SSE2 in 64-byte steps
+    if (n >= SIMD_MIN_SIZE && cpu_has_sse2) {
+        size_t head = -(uint32_t)d & 15;
+        movsb(&d, &src, head);
+        n -= head;
+        size_t bulk = n & ~(SIMD_BLOCK - 1);
+        copy_sse2(d, src, bulk);
+        d = (uint8_t *)d + bulk;
+        src = (const uint8_t *)src + bulk;
+        n -= bulk;
+    }
+#endif
+    if (n >= ALIGN_THRESHOLD) {
+        size_t head = -(uint32_t)d & 3;
+        movsb(&d, &src, head);
+        n -= head;
+    }
+    movsl(&d, &src, n >> 2);
+    movsb(&d, &src, n & 3);
+    return dst;
+}
+
+/*
+ * Forward copy is safe whenever dst is below src, so only a destination
+ * inside [src, src + n) needs the backward copy: std, rep movsd from the
+ * top down, then the low 0-3 bytes.
+ */
+void *memmove(void *dst, const void *src, size_t n) {
+    if ((uint32_t)dst - (uint32_t)src >= n)
+        return memcpy(dst, src, n);
+
+    uint8_t *d = (uint8_t *)dst + n;
+    const uint8_t *s = (const uint8_t *)src + n;
+    size_t words = n >> 2, bytes = n & 3;
+
+    d -= 4;
+    s -= 4;
+    __asm__ __volatile__("std\n"
+                         "rep movsl\n"
+                         "add $3, %%edi\n"
+                         "add $3, %%esi\n"
+                         "mov %3, %%ecx\n"
+                         "rep movsb\n"
+                         "cld"
+                         : "+D"(d), "+S"(s), "+c"(words)
+                         : "r"(bytes)
+                         : "memory");
+    return dst;
+}
+
+void *memset(void *dst, int c, size_t n) {
+    void *d = dst;
+    uint32_t pattern = (uint8_t)c * ONES;
+
+#ifdef CONFIG_SSE
+    if (n >= SIMD_MIN_SIZE && cpu_has_sse2) {
+        size_t head = -(uint32_t)d & 15;
+        n -= head;
+        __asm__ __volatile__("rep stosb" : "+D"(d), "+c"(head) : "a"(pattern) : "memory");
+        size_t bulk = n & ~(SIMD_BLOCK - 1);
+        set_sse2(d, pattern, bulk);
+        d = (uint8_t *)d + bulk;
+        n -= bulk;
+    }
+#endif
+    if (n >= ALIGN_THRESHOLD) {
+        size_t head = -(uint32_t)d & 3;
+        n -= head;
+        __asm__ __volatile__("rep stosb" : "+D"(d), "+c"(head) : "a"(pattern) : "memory");
+    }
+    size_t words = n >> 2, bytes = n & 3;
+    __asm__ __volatile__("rep stosl" : "+D"(d), "+c"(words) : "a"(pattern) : "memory");
+    __asm__ __volatile__("rep stosb" : "+D"(d), "+c"(bytes) : "a"(pattern) : "memory");
+    return dst;
+}
+
+// Skip equal words four bytes at a time, then find the differing byte.
+int memcmp(const void *a, const void *b, size_t n) {
+    const uint8_t *p = a, *q = b;
+
+    while (n >= 4 && *(const word_t *)p == *(const word_t *)q) {
+        p += 4;
+        q += 4;
+        n -= 4;
+    }
+    for (; n; n--, p++, q++) {
+        if (*p != *q)
+            return *p - *q;
+    }
+    return 0;
+}
+
+/*
+ * Bytes up to a word boundary, then whole aligned words until one has a
+ * zero byte ((v - ONES) & ~v & HIGHS is non-zero exactly then). Aligned
+ * word loads never cross into the next page, so reading past the
+ * terminator cannot fault.
+ */
+size_t strlen(const char *s) {
+    const char *p = s;
+
+    for (; (uint32_t)p & 3; p++) {
+        if (!*p)
+            return p - s;
+    }
+    while (!((*(const word_t *)p - ONES) & ~*(const word_t *)p & HIGHS))
+        p += 4;
+    while (*p)
+        p++;
+    return p - s;
+}
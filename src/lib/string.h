@@ -0,0 +1,19 @@
+#ifndef LIB_STRING_H
+#define LIB_STRING_H
+
+#include <stdint.h>
+
+typedef unsigned int size_t;
+
+/*
+ * Kernel memory and string primitives, built on the i386 string
+ * instructions. All of them assume the direction flag is clear on entry,
+ * as the C calling convention guarantees.
+ */
+void *memcpy(void *dst, const void *src, size_t n);
+void *memmove(void *dst, const void *src, size_t n);
+void *memset(void *dst, int c, size_t n);
+int memcmp(const void *a, const void *b, size_t n);
+size_t strlen(const char *s);
+
+#endif
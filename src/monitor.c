@@ -0,0 +1,53 @@
+#include <stdint.h>
+#include "monitor.h"
+#include "keyboard.h"
+#include "thread.h"
+#include "irqstat.h"
+#include "prof.h"
+#include "trace.h"
+#include "rprintf.h"
+
+/*
+ * Debug monitor: a thread that sleeps until a key arrives, reads keys
+ * from the keyboard and runs the matching dump command. One key per
+ * command, so it works without a shell or a line editor.
+ */
+struct monitor_cmd {
+    char key;
+    const char *help;
+    void (*fn)(void);
+};
+
+static const struct monitor_cmd commands[] = {
+    { 'i', "interrupt counts and handler cycles", irqstat_dump },
+    { 'r', "reset interrupt statistics",          irqstat_reset },
+    { 'p', "start profiler / stop and dump to serial", prof_toggle },
+#ifdef CONFIG_TRACE
+    { 't', "start tracing / stop and dump to serial", trace_toggle },
+#endif
+};
+
+#define NUM_COMMANDS (sizeof(commands) / sizeof(commands[0]))
+
+static void monitor_thread(void *arg) {
+    while (1) {
+        int c;
+
+        keyboard_wait();
+        while ((c = keyboard_getc()) >= 0) {
+            for (unsigned int i = 0; i < NUM_COMMANDS; i++) {
+                if (commands[i].key == c)
+                    commands[i].fn();
+            }
+        }
+    }
+}
+
+// Print the key map and start the monitor thread.
+void monitor_start(void) {
+    printk("Monitor keys:\n");
+    for (unsigned int i = 0; i < NUM_COMMANDS; i++) {
+        printk("  %c  %s\n", commands[i].key, commands[i].help);
+    }
+    thread_create("monitor", monitor_thread, 0, THREAD_PRIO_DEFAULT - 1);
+}
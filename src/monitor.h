@@ -0,0 +1,6 @@
+#ifndef MONITOR_H
+#define MONITOR_H
+
+void monitor_start(void);
+
+#endif
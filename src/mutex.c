@@ -0,0 +1,40 @@
+#include <stdint.h>
+#include "mutex.h"
+#include "thread.h"
+
+void mutex_lock(struct mutex *m) {
+    uint32_t flags = spin_lock_irqsave(&m->lock);
+
+    while (m->owner) {
+        struct thread *self = current;
+
+        self->wait_next = 0;
+        if (m->wait_tail)
+            m->wait_tail->wait_next = self;
+        else
+            m->wait_head = self;
+        m->wait_tail = self;
+        thread_block_unlock(&m->lock, flags);
+        flags = spin_lock_irqsave(&m->lock);
+    }
+    m->owner = current;
+    spin_unlock_irqrestore(&m->lock, flags);
+}
+
+// Release m and wake the longest waiter, which retries for it.
+void mutex_unlock(struct mutex *m) {
+    uint32_t flags = spin_lock_irqsave(&m->lock);
+    struct thread *next = m->wait_head;
+
+    m->owner = 0;
+    if (next) {
+        m->wait_head = next->wait_next;
+        if (!m->wait_head)
+            m->wait_tail = 0;
+        next->wait_next = 0;
+    }
+    spin_unlock_irqrestore(&m->lock, flags);
+
+    if (next)
+        thread_wake(next);
+}
@@ -0,0 +1,25 @@
+#ifndef MUTEX_H
+#define MUTEX_H
+
+#include "spinlock.h"
+
+struct thread;
+
+/*
+ * Sleeping lock for long critical sections in thread context (disk I/O,
+ * filesystem metadata). A contended locker blocks instead of spinning, so
+ * a holder that gets preempted cannot livelock a more urgent thread on
+ * the same CPU. Waiters queue in FIFO order. Not for interrupt handlers.
+ * A zero-initialized mutex is unlocked.
+ */
+struct mutex {
+    struct spinlock lock;            // guards owner and the wait list
+    struct thread *owner;
+    struct thread *wait_head;
+    struct thread *wait_tail;
+};
+
+void mutex_lock(struct mutex *m);
+void mutex_unlock(struct mutex *m);
+
+#endif
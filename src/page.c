@@ -1,8 +1,16 @@
 #include "page.h"
+#include "spinlock.h"
+#include "thread.h"
+#include "lib/string.h"
 #include <stdint.h>
 
-#define NUM_PAGES 128
-#define PAGE_SIZE (2 * 1024 * 1024)  
+#define PAGE_SIZE PAGE_FRAME_SIZE
+
+// Pre-zeroed frames kept ready for alloc_zeroed_page(). The refill thread
+// tops the pool up to ZERO_POOL_TARGET and sleeps; dropping below
+// ZERO_POOL_LOW wakes it again.
+#define ZERO_POOL_TARGET 64
+#define ZERO_POOL_LOW    (ZERO_POOL_TARGET / 2)
 
 //physical page array
 struct ppage physical_page_array[NUM_PAGES];
@@ -10,9 +18,22 @@ struct ppage physical_page_array[NUM_PAGES];
 //head pointer
 static struct ppage *free_list_head = 0;
 
+// Free frames known to be all zeroes
+static struct ppage *zero_list_head = 0;
+static uint32_t nr_zeroed;
+static struct thread *zero_thread;
+static int zero_thread_waiting;     // blocked in zero_refill(), wants a wake-up
+static int zero_pool_on = 1;
+uint32_t zero_pool_hits, zero_pool_misses;
+
+// Guards both free lists and refcounts; taken with IRQs off since the page
+// fault handler allocates.
+static struct spinlock pfa_lock;
+
 void init_pfa_list(void) {
     for (int i = 0; i < NUM_PAGES; i++) {
-        physical_page_array[i].physical_addr = (void *)(i * PAGE_SIZE);
+        physical_page_array[i].physical_addr = (void *)(PFA_BASE + i * PAGE_SIZE);
+        physical_page_array[i].refcount = 0;
 
         if (i > 0) {
             physical_page_array[i].prev = &physical_page_array[i-1];
@@ -31,38 +52,16 @@ void init_pfa_list(void) {
     free_list_head = &physical_page_array[0];
 }
 
-struct ppage *allocate_physical_pages(unsigned int npages) {
-    if (free_list_head == 0 || npages == 0) {
-        return 0; 
-    }
-
-    struct ppage *allocated_head = free_list_head;
-    struct ppage *current = free_list_head;
-
-    //moving npages forward
-    for (unsigned int i = 1; i < npages && current->next != 0; i++) {
-        current = current->next;
-    }
-    
-    //updating head
-    free_list_head = current->next;
-    if (free_list_head) {
-        free_list_head->prev = 0;
-    }
-
-    current->next = 0;
-
-    return allocated_head;
-}
-
-void free_physical_pages(struct ppage *ppage_list) {
+static void free_locked(struct ppage *ppage_list) {
     if (!ppage_list) 
         return;
 
     //tail of list being freed
     struct ppage *tail = ppage_list;
+    tail->refcount = 0;
     while (tail->next) {
         tail = tail->next;
+        tail->refcount = 0;
     }
 
     // freed block linking to head of free list
@@ -75,3 +74,184 @@ void free_physical_pages(struct ppage *ppage_list) {
     ppage_list->prev = 0;
 }
 
+static struct ppage *pop_locked(struct ppage **head) {
+    struct ppage *p = *head;
+
+    if (p) {
+        *head = p->next;
+        if (p->next)
+            p->next->prev = 0;
+        p->next = 0;
+    }
+    return p;
+}
+
+static void push_locked(struct ppage **head, struct ppage *p) {
+    p->prev = 0;
+    p->next = *head;
+    if (*head)
+        (*head)->prev = p;
+    *head = p;
+}
+
+// Callers that overwrite the frame anyway take dirty ones first, so the
+// zeroed pool is only spent when nothing else is left.
+static struct ppage *take_dirty_locked(void) {
+    struct ppage *p = pop_locked(&free_list_head);
+
+    if (!p && (p = pop_locked(&zero_list_head)))
+        nr_zeroed--;
+    return p;
+}
+
+// Wake the refill thread if the pool is low and there are dirty frames
+// to clear. Returns it, or 0; call thread_wake() after dropping the lock.
+static struct thread *zero_pool_check_locked(void) {
+    if (!zero_thread_waiting || nr_zeroed >= ZERO_POOL_LOW || !free_list_head)
+        return 0;
+    zero_thread_waiting = 0;
+    return zero_thread;
+}
+
+// Allocate up to npages frames, linked through next. Returns 0 if none are
+// free; a shorter list if only some are.
+struct ppage *allocate_physical_pages(unsigned int npages) {
+    uint32_t flags = spin_lock_irqsave(&pfa_lock);
+    struct ppage *allocated_head = 0, *tail = 0;
+
+    for (unsigned int i = 0; i < npages; i++) {
+        struct ppage *p = take_dirty_locked();
+        if (!p)
+            break;
+        p->refcount = 1;
+        p->prev = tail;
+        if (tail)
+            tail->next = p;
+        else
+            allocated_head = p;
+        tail = p;
+    }
+
+    spin_unlock_irqrestore(&pfa_lock, flags);
+    return allocated_head;
+}
+
+// One frame with unspecified contents, for callers that fill all of it.
+struct ppage *alloc_page(void) {
+    return allocate_physical_pages(1);
+}
+
+/*
+ * One frame of zeroes. Comes straight from the pre-zeroed pool when it has
+ * any, which keeps a 4 KiB clear off fault and page-table paths; otherwise
+ * a dirty frame is cleared here. Safe from the page fault handler.
+ */
+struct ppage *alloc_zeroed_page(void) {
+    uint32_t flags = spin_lock_irqsave(&pfa_lock);
+    struct ppage *p = zero_pool_on ? pop_locked(&zero_list_head) : 0;
+    int zeroed = p != 0;
+
+    if (zeroed) {
+        nr_zeroed--;
+        zero_pool_hits++;
+    } else {
+        p = take_dirty_locked();
+        zero_pool_misses++;
+    }
+    if (p)
+        p->refcount = 1;
+    struct thread *wake = zero_pool_check_locked();
+    spin_unlock_irqrestore(&pfa_lock, flags);
+
+    if (wake)
+        thread_wake(wake);
+    if (p && !zeroed)
+        memset(p->physical_addr, 0, PAGE_SIZE);
+    return p;
+}
+
+void free_physical_pages(struct ppage *ppage_list) {
+    uint32_t flags = spin_lock_irqsave(&pfa_lock);
+    free_locked(ppage_list);
+    struct thread *wake = zero_pool_check_locked();
+    spin_unlock_irqrestore(&pfa_lock, flags);
+
+    if (wake)
+        thread_wake(wake);
+}
+
+struct ppage *ppage_from_addr(void *paddr) {
+    uint32_t addr = (uint32_t)paddr;
+
+    if (addr < PFA_BASE || addr >= PFA_END)
+        return 0;
+    return &physical_page_array[(addr - PFA_BASE) / PAGE_SIZE];
+}
+
+void get_physical_page(struct ppage *ppage) {
+    if (!ppage)
+        return;
+
+    uint32_t flags = spin_lock_irqsave(&pfa_lock);
+    ppage->refcount++;
+    spin_unlock_irqrestore(&pfa_lock, flags);
+}
+
+void put_physical_page(struct ppage *ppage) {
+    if (!ppage)
+        return;
+
+    uint32_t flags = spin_lock_irqsave(&pfa_lock);
+    if (ppage->refcount != 0 && --ppage->refcount == 0) {
+        // free just this frame, even if it still heads an allocation list
+        ppage->next = 0;
+        free_locked(ppage);
+    }
+    struct thread *wake = zero_pool_check_locked();
+    spin_unlock_irqrestore(&pfa_lock, flags);
+
+    if (wake)
+        thread_wake(wake);
+}
+
+uint32_t zero_pool_count(void) {
+    return nr_zeroed;
+}
+
+// Bypass the pool (for measurements); alloc_zeroed_page() clears inline.
+void zero_pool_enable(int on) {
+    zero_pool_on = on;
+}
+
+/*
+ * Refill thread: move dirty frames to the zeroed pool one at a time,
+ * clearing each without the lock held, until the pool is full or no dirty
+ * frame is left. Then block until the pool is below ZERO_POOL_LOW with
+ * dirty frames to clear, which an allocation or a free can bring about.
+ * Runs just above the idle threads, so it only uses time
+ * nothing else wants.
+ */
+static void zero_refill(void *arg) {
+    while (1) {
+        uint32_t flags = spin_lock_irqsave(&pfa_lock);
+        if (nr_zeroed >= ZERO_POOL_TARGET || !free_list_head) {
+            zero_thread_waiting = 1;
+            thread_block_unlock(&pfa_lock, flags);
+            continue;
+        }
+        struct ppage *p = pop_locked(&free_list_head);
+        spin_unlock_irqrestore(&pfa_lock, flags);
+
+        memset(p->physical_addr, 0, PAGE_SIZE);
+
+        flags = spin_lock_irqsave(&pfa_lock);
+        push_locked(&zero_list_head, p);
+        nr_zeroed++;
+        spin_unlock_irqrestore(&pfa_lock, flags);
+    }
+}
+
+// Start filling the zeroed pool. Call once the scheduler is running.
+void zero_pool_start(void) {
+    zero_thread = thread_create("zerod", zero_refill, 0, THREAD_PRIO_IDLE - 1);
+}
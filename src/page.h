@@ -3,10 +3,19 @@
 
 #include <stdint.h>
 
+#define PAGE_FRAME_SIZE 4096
+#define NUM_PAGES 2048
+
+// Frames are handed out from [PFA_BASE, PFA_END). The first 4 MiB hold the
+// kernel image; the pool is identity-mapped so the kernel can reach any frame.
+#define PFA_BASE 0x00400000   // kernel.ld checks that the image ends below it
+#define PFA_END  (PFA_BASE + NUM_PAGES * PAGE_FRAME_SIZE)
+
 struct ppage {
    struct ppage *next;
    struct ppage *prev;
    void *physical_addr;
+   uint32_t refcount;   // number of mappings sharing this frame
 };
 
 //initializing first free page list
@@ -16,7 +25,28 @@ void init_pfa_list(void);
 //allocating npages from free list
 struct ppage *allocate_physical_pages(unsigned int npages);
 
+//single frame, contents undefined; for callers that overwrite all of it
+struct ppage *alloc_page(void);
+
+//single frame of zeroes, from the pre-zeroed pool when it has one
+struct ppage *alloc_zeroed_page(void);
+
 //list of pages freed, back into free list
 void free_physical_pages(struct ppage *ppage_list);
 
+//ppage describing the frame at paddr, or 0 if it is not a PFA frame
+struct ppage *ppage_from_addr(void *paddr);
+
+//take another reference to a single frame
+void get_physical_page(struct ppage *ppage);
+
+//drop a reference; the frame goes back on the free list when it reaches 0
+void put_physical_page(struct ppage *ppage);
+
+//pre-zeroed pool: refill thread, fill level, bypass switch for benchmarks
+void zero_pool_start(void);
+uint32_t zero_pool_count(void);
+void zero_pool_enable(int on);
+extern uint32_t zero_pool_hits, zero_pool_misses;
+
 #endif
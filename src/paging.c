@@ -1,49 +1,425 @@
+
 #include "paging.h"
 #include "rprintf.h"
 
 #define PAGE_SIZE 4096
+#define NUM_PAGE_TABLES 16
 
 // Must be global and 4KB-aligned
 struct page_directory_entry pd[1024] __attribute__((aligned(4096)));
-struct page pt[1024] __attribute__((aligned(4096)));
 
-void *map_pages(void *vaddr, struct ppage *pglist, struct page_directory_entry *pd) {
-    uint32_t vaddr_u32 = (uint32_t)vaddr;
-    uint32_t dir_index = vaddr_u32 >> 22;                // top 10 bits
-    uint32_t table_index = (vaddr_u32 >> 12) & 0x3FF;    // next 10 bits
+// Kernel-half page tables are handed out from this pool, one per 4 MiB of
+// address space that is mapped with 4 KiB pages. Regions mapped with 4 MiB
+// pages need none. User-half tables belong to one address space each and
+// come from the physical page allocator instead.
+static struct page page_tables[NUM_PAGE_TABLES][1024] __attribute__((aligned(4096)));
+static int next_page_table = 0;
+
+uint32_t tlb_flush_threshold = TLB_FLUSH_THRESHOLD_DEFAULT;
 
-    // Setup PDE if not present
+static uint32_t next_mmio = MMIO_WINDOW;
+
+static void clear_page_table(struct page *table) {
+    uint32_t *words = (uint32_t *)table;
+    for (int i = 0; i < 1024; i++) {
+        words[i] = 0;
+    }
+}
+
+// Return the page table behind pd[dir_index], creating it if needed.
+// Returns 0 if the slot holds a 4 MiB page or the pool is exhausted.
+static struct page *get_page_table(struct page_directory_entry *pd, uint32_t dir_index) {
+    if (pd[dir_index].present) {
+        if (pd[dir_index].pagesize) {
+            return 0;
+        }
+        return (struct page *)(pd[dir_index].frame << 12);
+    }
+
+    struct page *table;
+    int user = !is_kernel_address(dir_index << 22);
+    if (user) {
+        struct ppage *frame = alloc_zeroed_page();
+        if (!frame) {
+            return 0;
+        }
+        table = frame->physical_addr;
+    } else {
+        if (next_page_table >= NUM_PAGE_TABLES) {
+            return 0;
+        }
+        table = page_tables[next_page_table++];
+        clear_page_table(table);
+    }
+
+    // User access is still limited per page by the PTE's own user bit
     pd[dir_index].present = 1;
     pd[dir_index].rw = 1;
-    pd[dir_index].user = 0;
-    pd[dir_index].frame = ((uint32_t)pt) >> 12; // physical address of page table
+    pd[dir_index].user = user;
+    pd[dir_index].pagesize = 0;
+    pd[dir_index].frame = ((uint32_t)table) >> 12; // physical address of page table
+
+    // The recursive window may still cache whatever used to be in this slot
+    if (pd == current_page_directory())
+        invlpg((void *)(PTE_WINDOW + (dir_index << 12)));
+    return table;
+}
+
+void *map_pages(void *vaddr, struct ppage *pglist, struct page_directory_entry *pd) {
+    uint32_t vaddr_u32 = (uint32_t)vaddr;
 
     struct ppage *current = pglist;
     while (current) {
+        uint32_t dir_index = vaddr_u32 >> 22;                // top 10 bits
+        uint32_t table_index = (vaddr_u32 >> 12) & 0x3FF;    // next 10 bits
+
+        struct page *pt = get_page_table(pd, dir_index);
+        if (!pt)
+            return 0;
+
         pt[table_index].present = 1;
         pt[table_index].rw = 1;
         pt[table_index].user = 0;
+        pt[table_index].global = is_kernel_address(vaddr_u32);
         pt[table_index].frame = ((uint32_t)current->physical_addr) >> 12;
 
-        table_index++;
-        if (table_index >= 1024)
-            break;
-
+        vaddr_u32 += PAGE_SIZE;
         current = current->next;
     }
 
     return vaddr;
 }
 
+// Map one 4 MiB page. Both addresses must be 4 MiB aligned and CR4.PSE must be
+// set before the mapping is used. Any page table previously installed in this
+// slot is simply dropped from the directory.
+void *map_large_page(void *vaddr, void *paddr, struct page_directory_entry *pd) {
+    uint32_t dir_index = (uint32_t)vaddr >> 22;
+
+    if (((uint32_t)vaddr | (uint32_t)paddr) & (PAGE_SIZE_4M - 1))
+        return 0;
+
+    pd[dir_index].present = 1;
+    pd[dir_index].rw = 1;
+    pd[dir_index].user = 0;
+    pd[dir_index].pagesize = 1;
+    pd[dir_index].global = is_kernel_address(vaddr);
+    pd[dir_index].frame = ((uint32_t)paddr) >> 12;
+
+    return vaddr;
+}
+
+// Map a physically contiguous region, using 4 MiB pages wherever vaddr, paddr
+// and the remaining size allow it and 4 KiB pages for the unaligned edges.
+void map_region(void *vaddr, void *paddr, uint32_t size, struct page_directory_entry *pd) {
+    uint32_t v = (uint32_t)vaddr & ~(PAGE_SIZE - 1);
+    uint32_t p = (uint32_t)paddr & ~(PAGE_SIZE - 1);
+    uint32_t end = (uint32_t)vaddr + size;
+
+    while (v < end) {
+        if (((v | p) & (PAGE_SIZE_4M - 1)) == 0 && end - v >= PAGE_SIZE_4M) {
+            map_large_page((void *)v, (void *)p, pd);
+            v += PAGE_SIZE_4M;
+            p += PAGE_SIZE_4M;
+        } else {
+            // 4 KiB pages up to the next 4 MiB boundary (or the end)
+            uint32_t run_end = (v + PAGE_SIZE_4M) & ~(PAGE_SIZE_4M - 1);
+            if (run_end > end || run_end == 0)
+                run_end = end;
+            uint32_t npages = (run_end - v + PAGE_SIZE - 1) / PAGE_SIZE;
+            map_range((void *)v, (void *)p, npages, pd);
+            v += npages * PAGE_SIZE;
+            p += npages * PAGE_SIZE;
+        }
+    }
+}
+
+struct page_directory_entry *current_page_directory(void) {
+    uint32_t cr3;
+    asm volatile("mov %%cr3, %0" : "=r"(cr3));
+    return (struct page_directory_entry *)(cr3 & ~(PAGE_SIZE - 1));
+}
+
+// Drop stale translations for npages starting at vaddr, but only if pd is
+// the directory the CPU is actually using.
+static void invalidate_range(uint32_t vaddr, uint32_t npages, struct page_directory_entry *pd) {
+    if (npages == 0 || pd != current_page_directory())
+        return;
+
+    if (npages > tlb_flush_threshold) {
+        // A CR3 reload leaves global (kernel half) entries behind
+        if (is_kernel_address(vaddr))
+            flush_tlb_all();
+        else
+            flush_tlb();
+        return;
+    }
+    for (uint32_t i = 0; i < npages; i++) {
+        invlpg((void *)(vaddr + i * PAGE_SIZE));
+    }
+}
+
+// Replace the 4 MiB page in pd[dir_index] with a page table mapping the same
+// frames, so that part of it can be changed. Returns 0 if out of tables.
+static struct page *split_large_page(struct page_directory_entry *pd, uint32_t dir_index) {
+    uint32_t base = pd[dir_index].frame << 12;
+
+    if (next_page_table >= NUM_PAGE_TABLES) {
+        return 0;
+    }
+    struct page *table = page_tables[next_page_table++];
+    clear_page_table(table);
+    for (int i = 0; i < 1024; i++) {
+        table[i].present = 1;
+        table[i].rw = pd[dir_index].rw;
+        table[i].user = pd[dir_index].user;
+        table[i].global = pd[dir_index].global;
+        table[i].frame = (base >> 12) + i;
+    }
+
+    pd[dir_index].pagesize = 0;
+    pd[dir_index].global = 0;
+    pd[dir_index].frame = ((uint32_t)table) >> 12;
+    return table;
+}
+
+/*
+ * Map npages physically contiguous 4 KiB pages at vaddr. The page table is
+ * looked up once per 4 MiB slot rather than once per page, and only entries
+ * that were already present (i.e. remapped) are invalidated afterwards.
+ * Returns 0 on success, -1 if a page table could not be allocated.
+ */
+int map_range(void *vaddr, void *paddr, uint32_t npages, struct page_directory_entry *pd) {
+    uint32_t v = (uint32_t)vaddr & ~(PAGE_SIZE - 1);
+    uint32_t frame = (uint32_t)paddr >> 12;
+    uint32_t remapped = 0;
+    int result = 0;
+
+    for (uint32_t done = 0; done < npages; ) {
+        uint32_t dir_index = (v + done * PAGE_SIZE) >> 22;
+        uint32_t table_index = ((v + done * PAGE_SIZE) >> 12) & 0x3FF;
+
+        struct page *pt;
+        if (pd[dir_index].present && pd[dir_index].pagesize)
+            pt = split_large_page(pd, dir_index);
+        else
+            pt = get_page_table(pd, dir_index);
+        if (!pt) {
+            result = -1;
+            npages = done;
+            break;
+        }
+
+        for (; table_index < 1024 && done < npages; table_index++, done++) {
+            if (pt[table_index].present)
+                remapped++;
+            pt[table_index].present = 1;
+            pt[table_index].rw = 1;
+            pt[table_index].user = 0;
+            pt[table_index].global = is_kernel_address(v + done * PAGE_SIZE);
+            pt[table_index].frame = frame + done;
+        }
+    }
+
+    if (remapped)
+        invalidate_range(v, npages, pd);
+    return result;
+}
+
+/*
+ * Remove npages 4 KiB mappings starting at vaddr, then invalidate them with
+ * invlpg or, for large ranges, one full flush. Whole 4 MiB pages inside the
+ * range are dropped from the directory; partially covered ones are split.
+ * The backing frames are not freed.
+ * Returns 0 on success, -1 if a large page could not be split (it is left
+ * mapped).
+ */
+int unmap_range(void *vaddr, uint32_t npages, struct page_directory_entry *pd) {
+    uint32_t v = (uint32_t)vaddr & ~(PAGE_SIZE - 1);
+    int result = 0;
+
+    for (uint32_t done = 0; done < npages; ) {
+        uint32_t addr = v + done * PAGE_SIZE;
+        uint32_t dir_index = addr >> 22;
+        uint32_t table_index = (addr >> 12) & 0x3FF;
+
+        if (!pd[dir_index].present) {
+            done += 1024 - table_index;
+            continue;
+        }
+
+        if (pd[dir_index].pagesize) {
+            if (table_index == 0 && npages - done >= 1024) {
+                pd[dir_index].present = 0;
+                done += 1024;
+                continue;
+            }
+            if (!split_large_page(pd, dir_index)) {
+                result = -1;
+                done += 1024 - table_index;
+                continue;
+            }
+        }
+
+        struct page *pt = (struct page *)(pd[dir_index].frame << 12);
+        for (; table_index < 1024 && done < npages; table_index++, done++) {
+            pt[table_index].present = 0;
+        }
+    }
+
+    invalidate_range(v, npages, pd);
+    return result;
+}
+
+// PTE for vaddr in pd, optionally creating its page table. Returns 0 if there
+// is no table (or vaddr lies in a 4 MiB page). Page tables are reached through
+// the identity map, so this works on any directory, loaded or not.
+struct page *lookup_pte(struct page_directory_entry *pd, void *vaddr, int create) {
+    uint32_t dir_index = (uint32_t)vaddr >> 22;
+    uint32_t table_index = ((uint32_t)vaddr >> 12) & 0x3FF;
+
+    if (!pd[dir_index].present && !create)
+        return 0;
+    struct page *pt = get_page_table(pd, dir_index);
+    if (!pt)
+        return 0;
+    return &pt[table_index];
+}
+
+/*
+ * Map size bytes of physical address space at paddr into the MMIO window,
+ * uncached, in the kernel directory. Returns the virtual address matching
+ * paddr, or 0 once the window is used up. Mappings are never released, so
+ * this is for boot-time device setup.
+ */
+void *map_mmio(uint32_t paddr, uint32_t size) {
+    uint32_t offset = paddr & (PAGE_SIZE - 1);
+    uint32_t npages = (offset + size + PAGE_SIZE - 1) / PAGE_SIZE;
+    uint32_t vaddr = next_mmio;
+
+    if (npages > (MMIO_WINDOW_END - next_mmio) / PAGE_SIZE)
+        return 0;
+    if (map_range((void *)vaddr, (void *)(paddr - offset), npages, pd) != 0)
+        return 0;
+    for (uint32_t i = 0; i < npages; i++) {
+        struct page *pte = lookup_pte(pd, (void *)(vaddr + i * PAGE_SIZE), 0);
+        pte->cachedisabled = 1;
+        pte->writethru = 1;
+    }
+
+    next_mmio += npages * PAGE_SIZE;
+    return (void *)(vaddr + offset);
+}
+
+// Point the last PDE at pd itself. Only the kernel may use the window.
+void map_recursive(struct page_directory_entry *pd) {
+    pd[RECURSIVE_PDE].present = 1;
+    pd[RECURSIVE_PDE].rw = 1;
+    pd[RECURSIVE_PDE].user = 0;
+    pd[RECURSIVE_PDE].pagesize = 0;
+    pd[RECURSIVE_PDE].global = 0;
+    pd[RECURSIVE_PDE].frame = ((uint32_t)pd) >> 12;
+}
+
+/*
+ * PTE for vaddr in the loaded address space, found through the recursive
+ * mapping with no table walk. Returns 0 if vaddr has no page table (or lies
+ * in a 4 MiB page). Paging must be on.
+ */
+struct page *get_pte(void *vaddr) {
+    uint32_t v = (uint32_t)vaddr;
+    struct page_directory_entry *pde = (struct page_directory_entry *)PD_WINDOW + (v >> 22);
+
+    if (!pde->present || pde->pagesize)
+        return 0;
+    return (struct page *)PTE_WINDOW + (v >> 12);
+}
+
+// Physical address behind vaddr in the loaded address space, or VIRT_UNMAPPED.
+uint32_t virt_to_phys(void *vaddr) {
+    uint32_t v = (uint32_t)vaddr;
+    struct page_directory_entry *pde = (struct page_directory_entry *)PD_WINDOW + (v >> 22);
+
+    if (!pde->present)
+        return VIRT_UNMAPPED;
+    if (pde->pagesize)
+        return ((pde->frame << 12) & ~(PAGE_SIZE_4M - 1)) | (v & (PAGE_SIZE_4M - 1));
+
+    struct page *pte = (struct page *)PTE_WINDOW + (v >> 12);
+    if (!pte->present)
+        return VIRT_UNMAPPED;
+    return (pte->frame << 12) | (v & (PAGE_SIZE - 1));
+}
+
 void loadPageDirectory(struct page_directory_entry *pd) {
     asm volatile("mov %0, %%cr3" :: "r"(pd));
 }
 
-void enable_paging(void) {
+void invlpg(void *vaddr) {
+    asm volatile("invlpg (%0)" :: "r"(vaddr) : "memory");
+}
+
+// Reloading CR3 discards every non-global TLB entry.
+void flush_tlb(void) {
+    asm volatile(
+        "mov %%cr3, %%eax\n"
+        "mov %%eax, %%cr3"
+        ::: "eax", "memory"
+    );
+}
+
+// Also drops global entries, by toggling CR4.PGE off and back on.
+void flush_tlb_all(void) {
+    asm volatile(
+        "mov %%cr4, %%eax\n"
+        "test %0, %%eax\n"
+        "jz 1f\n"
+        "xor %0, %%eax\n"
+        "mov %%eax, %%cr4\n"
+        "or %0, %%eax\n"
+        "mov %%eax, %%cr4\n"
+        "jmp 2f\n"
+        "1:\n"
+        "mov %%cr3, %%eax\n"
+        "mov %%eax, %%cr3\n"
+        "2:\n"
+        :: "i"(CR4_PGE) : "eax", "memory"
+    );
+}
+
+void enable_pse(void) {
     asm volatile(
-        "mov %cr0, %eax\n"
-        "or $0x80000001, %eax\n"
-        "mov %eax, %cr0"
+        "mov %%cr4, %%eax\n"
+        "or %0, %%eax\n"
+        "mov %%eax, %%cr4"
+        :: "i"(CR4_PSE) : "eax"
     );
 }
 
+void enable_global_pages(void) {
+    asm volatile(
+        "mov %%cr4, %%eax\n"
+        "or %0, %%eax\n"
+        "mov %%eax, %%cr4"
+        :: "i"(CR4_PGE) : "eax"
+    );
+}
+
+// Clearing CR4.PGE also flushes every TLB entry, global or not.
+void disable_global_pages(void) {
+    asm volatile(
+        "mov %%cr4, %%eax\n"
+        "and %0, %%eax\n"
+        "mov %%eax, %%cr4"
+        :: "i"(~CR4_PGE) : "eax", "memory"
+    );
+}
+
+void enable_paging(void) {
+    asm volatile(
+        "mov %%cr0, %%eax\n"
+        "or %0, %%eax\n"
+        "mov %%eax, %%cr0"
+        :: "i"(0x80000001 | CR0_WP) : "eax"
+    );
+}
@@ -4,6 +4,35 @@
 #include <stdint.h>
 #include "page.h"
 
+#define PAGE_SIZE_4K  0x1000
+#define PAGE_SIZE_4M  0x400000
+
+#define CR4_PSE (1 << 4)   // page size extensions (4 MiB pages)
+#define CR4_PGE (1 << 7)   // global pages survive CR3 reloads
+#define CR0_WP  (1 << 16)  // honour read-only PTEs in ring 0 too (needed for COW)
+
+// [0, KERNEL_SPACE_END) is the kernel half of every address space. Mappings
+// there are marked global so they stay in the TLB across CR3 switches.
+#define KERNEL_SPACE_END 0x40000000
+#define is_kernel_address(addr) ((uint32_t)(addr) < KERNEL_SPACE_END)
+
+// The last PDE points back at the directory itself, so the loaded address
+// space's page tables appear at PTE_WINDOW and its directory at PD_WINDOW.
+#define RECURSIVE_PDE 1023
+#define PTE_WINDOW    0xFFC00000
+#define PD_WINDOW     0xFFFFF000
+#define VIRT_UNMAPPED 0xFFFFFFFF
+
+// Device registers and firmware tables are mapped uncached into the last
+// 4 MiB of the kernel half, so every address space sees them.
+#define MMIO_WINDOW     (KERNEL_SPACE_END - PAGE_SIZE_4M)
+#define MMIO_WINDOW_END KERNEL_SPACE_END
+
+// Ranges up to this many pages are invalidated with invlpg, larger ones with
+// a full CR3 reload. Tunable at runtime (the benchmarks set it to 0).
+#define TLB_FLUSH_THRESHOLD_DEFAULT 32
+extern uint32_t tlb_flush_threshold;
+
 // Page directory entry
 struct page_directory_entry {
     uint32_t present       : 1;
@@ -12,27 +41,53 @@ struct page_directory_entry {
     uint32_t writethru     : 1;
     uint32_t cachedisabled : 1;
     uint32_t accessed      : 1;
-    uint32_t pagesize      : 1;
-    uint32_t ignored       : 2;
+    uint32_t dirty         : 1;   // 4 MiB pages only
+    uint32_t pagesize      : 1;   // 1 = entry maps a 4 MiB page directly (needs CR4.PSE)
+    uint32_t global        : 1;   // 4 MiB pages only
     uint32_t os_specific   : 3;
-    uint32_t frame         : 20;
+    uint32_t frame         : 20;  // for 4 MiB pages only the top 10 bits are used
 };
 
+_Static_assert(sizeof(struct page_directory_entry) == 4, "PDE must be 32 bits");
+
 // Page table entry
 struct page {
-    uint32_t present  : 1;
-    uint32_t rw       : 1;
-    uint32_t user     : 1;
-    uint32_t accessed : 1;
-    uint32_t dirty    : 1;
-    uint32_t unused   : 7;
-    uint32_t frame    : 20;
+    uint32_t present       : 1;
+    uint32_t rw            : 1;
+    uint32_t user          : 1;
+    uint32_t writethru     : 1;
+    uint32_t cachedisabled : 1;
+    uint32_t accessed      : 1;
+    uint32_t dirty         : 1;
+    uint32_t pat           : 1;
+    uint32_t global        : 1;   // not flushed by CR3 reloads (needs CR4.PGE)
+    uint32_t cow           : 1;   // read-only because shared copy-on-write (OS-defined bit)
+    uint32_t demand        : 1;   // not present yet: first touch maps a zeroed frame (OS-defined)
+    uint32_t unused        : 1;
+    uint32_t frame         : 20;
 };
 
+_Static_assert(sizeof(struct page) == 4, "PTE must be 32 bits");
+
 // Function prototypes
 void *map_pages(void *vaddr, struct ppage *pglist, struct page_directory_entry *pd);
+void *map_large_page(void *vaddr, void *paddr, struct page_directory_entry *pd);
+void map_region(void *vaddr, void *paddr, uint32_t size, struct page_directory_entry *pd);
+int map_range(void *vaddr, void *paddr, uint32_t npages, struct page_directory_entry *pd);
+int unmap_range(void *vaddr, uint32_t npages, struct page_directory_entry *pd);
+void invlpg(void *vaddr);
+void flush_tlb(void);
+void flush_tlb_all(void);
+struct page *lookup_pte(struct page_directory_entry *pd, void *vaddr, int create);
+void *map_mmio(uint32_t paddr, uint32_t size);
+void map_recursive(struct page_directory_entry *pd);
+struct page *get_pte(void *vaddr);
+uint32_t virt_to_phys(void *vaddr);
 void loadPageDirectory(struct page_directory_entry *pd);
+struct page_directory_entry *current_page_directory(void);
+void enable_pse(void);
+void enable_global_pages(void);
+void disable_global_pages(void);
 void enable_paging(void);
 
 #endif
-
@@ -0,0 +1,165 @@
+#include <stdint.h>
+#include "prof.h"
+#include "smp.h"
+#include "timer.h"
+#include "serial.h"
+#include "rprintf.h"
+
+// Flat histogram: one counter per 16 bytes of kernel text
+#define PROF_BUCKET_SHIFT 4
+#define PROF_TEXT_MAX     (128 * 1024)
+#define PROF_BUCKETS      (PROF_TEXT_MAX >> PROF_BUCKET_SHIFT)
+
+// Call chains for flame graphs: the last PROF_STACKS samples per CPU
+#define PROF_MAX_DEPTH    15
+#define PROF_STACKS       512
+
+struct prof_stack {
+    uint32_t depth;
+    uint32_t pc[PROF_MAX_DEPTH];     // interrupted EIP first, then callers
+};
+
+struct prof_cpu {
+    uint32_t hist[PROF_BUCKETS];
+    uint32_t user;                   // samples taken in ring 3
+    uint32_t other;                  // kernel samples outside the histogram
+    uint32_t countdown;              // ticks until the next sample
+    uint32_t nstacks;                // samples recorded; ring index mod PROF_STACKS
+    struct prof_stack stacks[PROF_STACKS];
+};
+
+extern char _start_text[], _end_text[];
+extern char _start_data[], _end_kernel[];
+static struct prof_cpu prof_cpus[MAX_CPUS];
+static volatile int prof_enabled = 0;
+static uint32_t prof_hz;
+static uint32_t prof_period;         // timer ticks per sample
+
+/*
+ * Walk the saved frame pointers of the interrupted code. The kernel is
+ * built without -fomit-frame-pointer, and every IRQ_HANDLER wrapper pushes
+ * ebp first, so the interrupted ebp sits in the word right below the
+ * hardware frame. Stops at anything that does not look like a frame on
+ * one of the kernel's stacks, which all live in its data and bss.
+ */
+static void record_stack(struct prof_stack *s, struct interrupt_frame *frame) {
+    uint32_t *fp = (uint32_t *)((uint32_t *)frame)[-1];
+    uint32_t *prev = 0;
+
+    s->pc[0] = frame->eip;
+    s->depth = 1;
+    while (s->depth < PROF_MAX_DEPTH) {
+        if (((uint32_t)fp & 3) || fp <= prev ||
+            (char *)fp < _start_data || (char *)(fp + 2) > _end_kernel)
+            break;
+        uint32_t ret = fp[1];
+        if (ret < (uint32_t)_start_text || ret >= (uint32_t)_end_text)
+            break;
+        s->pc[s->depth++] = ret;
+        prev = fp;
+        fp = (uint32_t *)fp[0];
+    }
+}
+
+/*
+ * Called from the timer interrupt on every CPU with the interrupted
+ * context. Every prof_period ticks, count the EIP and keep its call chain.
+ */
+void prof_sample(struct interrupt_frame *frame) {
+    if (!prof_enabled)
+        return;
+
+    struct prof_cpu *p = &prof_cpus[this_cpu()->id];
+    if (--p->countdown > 0)
+        return;
+    p->countdown = prof_period;
+
+    if (frame->cs & 3) {
+        p->user++;
+        return;
+    }
+
+    uint32_t off = frame->eip - (uint32_t)_start_text;
+    if (off < PROF_TEXT_MAX)
+        p->hist[off >> PROF_BUCKET_SHIFT]++;
+    else
+        p->other++;
+    record_stack(&p->stacks[p->nstacks++ % PROF_STACKS], frame);
+}
+
+// Clear all samples and start sampling at hz (at most the timer rate).
+void prof_start(uint32_t hz) {
+    prof_enabled = 0;
+    if (hz == 0 || hz > CONFIG_TIMER_HZ)
+        hz = CONFIG_TIMER_HZ;
+    prof_hz = hz;
+    prof_period = CONFIG_TIMER_HZ / hz;
+
+    for (int c = 0; c < MAX_CPUS; c++) {
+        struct prof_cpu *p = &prof_cpus[c];
+        for (int i = 0; i < PROF_BUCKETS; i++) {
+            p->hist[i] = 0;
+        }
+        p->user = 0;
+        p->other = 0;
+        p->nstacks = 0;
+        p->countdown = prof_period;
+    }
+    __atomic_store_n(&prof_enabled, 1, __ATOMIC_RELEASE);
+}
+
+void prof_stop(void) {
+    prof_enabled = 0;
+}
+
+int prof_running(void) {
+    return prof_enabled;
+}
+
+#define sout(...) esp_wprintf(serial_write, __VA_ARGS__)
+
+/*
+ * Stream every sample over COM1 as text lines that tools/prof.py turns
+ * into a flat profile and folded stacks, symbolized against the kernel ELF:
+ *   PROF BEGIN <hz> <cpus>
+ *   PROF H <cpu> <pc> <count>        histogram bucket (hex pc)
+ *   PROF U <cpu> <user> <other>      samples outside kernel text
+ *   PROF S <cpu> <pc> <caller> ...   one call chain, innermost first
+ *   PROF END
+ * Stop the profiler first.
+ */
+void prof_dump(void) {
+    sout("PROF BEGIN %d %d\n", prof_hz, cpus_online);
+    for (uint32_t c = 0; c < cpus_online; c++) {
+        struct prof_cpu *p = &prof_cpus[c];
+
+        for (int i = 0; i < PROF_BUCKETS; i++) {
+            if (p->hist[i])
+                sout("PROF H %d %x %d\n", c, (uint32_t)_start_text + (i << PROF_BUCKET_SHIFT), p->hist[i]);
+        }
+        sout("PROF U %d %d %d\n", c, p->user, p->other);
+
+        uint32_t n = p->nstacks < PROF_STACKS ? p->nstacks : PROF_STACKS;
+        for (uint32_t i = 0; i < n; i++) {
+            struct prof_stack *s = &p->stacks[i];
+            sout("PROF S %d", c);
+            for (uint32_t d = 0; d < s->depth; d++) {
+                sout(" %x", s->pc[d]);
+            }
+            sout("\n");
+        }
+    }
+    sout("PROF END\n");
+}
+
+// Monitor command: start profiling, or stop and dump to serial.
+void prof_toggle(void) {
+    if (prof_running()) {
+        prof_stop();
+        printk("Profiler stopped, dumping to serial\n");
+        prof_dump();
+    } else {
+        printk("Profiler started at %d Hz\n", PROF_HZ_DEFAULT);
+        prof_start(PROF_HZ_DEFAULT);
+    }
+}
@@ -0,0 +1,16 @@
+#ifndef PROF_H
+#define PROF_H
+
+#include <stdint.h>
+#include "interrupt.h"
+
+#define PROF_HZ_DEFAULT 1000
+
+void prof_start(uint32_t hz);
+void prof_stop(void);
+int prof_running(void);
+void prof_sample(struct interrupt_frame *frame);
+void prof_dump(void);
+void prof_toggle(void);
+
+#endif
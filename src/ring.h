@@ -0,0 +1,57 @@
+#ifndef RING_H
+#define RING_H
+
+#include <stdint.h>
+
+/*
+ * Lock-free single-producer/single-consumer ring buffer.
+ *
+ * SPSC_RING_DECLARE(name, type, order) defines struct name holding
+ * 2^order elements of type, plus name_push(), name_pop() and name_count().
+ * Exactly one context may push (e.g. an IRQ handler) and exactly one may
+ * pop (e.g. a thread). Synchronization is only through the two free-running
+ * indices: the producer owns head, the consumer owns tail, and each
+ * publishes with a release store that the other side reads with an acquire
+ * load. No locks and no cli, so it is safe against being interrupted at any
+ * point by the other side. This header is also built on the host (see
+ * queue_practice.c).
+ *
+ * A zero-initialized struct is an empty ring.
+ */
+#define SPSC_RING_DECLARE(name, type, order)                                  \
+struct name {                                                                 \
+    uint32_t head;                  /* next slot to write, producer only */   \
+    uint32_t tail;                  /* next slot to read, consumer only */    \
+    type slots[1u << (order)];                                                \
+};                                                                            \
+                                                                              \
+/* Returns 0 on success, -1 if the ring is full. Producer side only. */       \
+static inline int name##_push(struct name *r, type value) {                  \
+    uint32_t head = r->head;                                                  \
+    uint32_t tail = __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);              \
+    if (head - tail == (1u << (order)))                                       \
+        return -1;                                                            \
+    r->slots[head & ((1u << (order)) - 1)] = value;                           \
+    __atomic_store_n(&r->head, head + 1, __ATOMIC_RELEASE);                   \
+    return 0;                                                                 \
+}                                                                             \
+                                                                              \
+/* Returns 0 and stores the oldest element in *value, -1 if empty.            \
+   Consumer side only. */                                                     \
+static inline int name##_pop(struct name *r, type *value) {                  \
+    uint32_t tail = r->tail;                                                  \
+    uint32_t head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);              \
+    if (head == tail)                                                         \
+        return -1;                                                            \
+    *value = r->slots[tail & ((1u << (order)) - 1)];                          \
+    __atomic_store_n(&r->tail, tail + 1, __ATOMIC_RELEASE);                   \
+    return 0;                                                                 \
+}                                                                             \
+                                                                              \
+/* Snapshot of the number of queued elements; safe from either side. */      \
+static inline uint32_t name##_count(struct name *r) {                        \
+    return __atomic_load_n(&r->head, __ATOMIC_ACQUIRE) -                      \
+           __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);                       \
+}
+
+#endif
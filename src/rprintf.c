@@ -8,6 +8,7 @@
 /*---------------------------------------------------*/
 
 #include "rprintf.h"
+#include "lib/string.h"
 /*---------------------------------------------------*/
 /* The purpose of this routine is to output data the */
 /* same as the standard printf function without the  */
@@ -16,21 +17,34 @@
 /* that is unacceptable in most embedded systems.    */
 /*---------------------------------------------------*/
 
-static func_ptr out_char;
-static int do_padding;
-static int left_flag;
-static int len;
-static int num1;
-static int num2;
-static char pad_character;
-
-size_t strlen(const char *str) {
-    unsigned int len = 0;
-    while(str[len] != '\0') {
-        len++;
-    }
-    return len;
-}
+/*---------------------------------------------------*/
+/* All formatting state lives in a struct fmt_ctx on */
+/* the caller's stack, so any number of CPUs and     */
+/* interrupt handlers can format at once. Output is  */
+/* collected in ctx->buf and handed to the sink a    */
+/* chunk at a time; the snprintf family writes into  */
+/* the caller's buffer instead.                      */
+/*---------------------------------------------------*/
+
+#define FMT_BUF_SIZE 64
+
+struct fmt_ctx {
+   write_func write;    /* chunk sink, or NULL */
+   func_ptr   out;      /* per-character sink, or NULL */
+   char      *str;      /* snprintf destination when both are NULL */
+   size_t     size;     /* ... and its size, terminator included */
+   size_t     count;    /* characters produced so far */
+   int        pos;      /* bytes waiting in buf */
+   char       buf[FMT_BUF_SIZE];
+
+   /* per-conversion flags */
+   int  do_padding;
+   int  left_flag;
+   int  len;
+   int  num1;
+   int  num2;
+   char pad_character;
+};
 
 int tolower(int c) {
     if(c < 'a') { // Check if c is uppercase
@@ -50,18 +64,51 @@ int isdig(int c) {
 
 
 
+/*---------------------------------------------------*/
+/*                                                   */
+/* This routine hands everything buffered so far to  */
+/* the sink.                                         */
+/*                                                   */
+static void flush( struct fmt_ctx *ctx)
+{
+   int i;
+
+   if (ctx->write)
+      ctx->write( ctx->buf, ctx->pos);
+   else if (ctx->out)
+      for (i=0; i<ctx->pos; i++)
+          ctx->out( ctx->buf[i]);
+   ctx->pos = 0;
+   }
+
+/*---------------------------------------------------*/
+/*                                                   */
+/* This routine adds one character to the output.    */
+/*                                                   */
+static void out_char( struct fmt_ctx *ctx, const char c)
+{
+   if (ctx->write || ctx->out) {
+      ctx->buf[ctx->pos++] = c;
+      if (ctx->pos == FMT_BUF_SIZE)
+         flush( ctx);
+      }
+   else if (ctx->count + 1 < ctx->size)
+      ctx->str[ctx->count] = c;
+   ctx->count++;
+   }
+
 /*---------------------------------------------------*/
 /*                                                   */
 /* This routine puts pad characters into the output  */
 /* buffer.                                           */
 /*                                                   */
-static void padding( const int l_flag)
+static void padding( struct fmt_ctx *ctx, const int l_flag)
 {
    int i;
 
-   if (do_padding && l_flag && (len < num1))
-      for (i=len; i<num1; i++)
-          out_char( pad_character);
+   if (ctx->do_padding && l_flag && (ctx->len < ctx->num1))
+      for (i=ctx->len; i<ctx->num1; i++)
+          out_char( ctx, ctx->pad_character);
    }
 
 /*---------------------------------------------------*/
@@ -69,21 +116,21 @@ static void padding( const int l_flag)
 /* This routine moves a string to the output buffer  */
 /* as directed by the padding and positioning flags. */
 /*                                                   */
-static void outs( charptr lp)
+static void outs( struct fmt_ctx *ctx, charptr lp)
 {
    if(lp == NULL)
       lp = "(null)";
    /* pad on left if needed                          */
-   len = strlen( lp);
-   padding( !left_flag);
+   ctx->len = strlen( lp);
+   padding( ctx, !ctx->left_flag);
 
    /* Move string to the buffer                      */
-   while (*lp && num2--)
-      out_char( *lp++);
+   while (*lp && ctx->num2--)
+      out_char( ctx, *lp++);
 
    /* Pad on right if needed                         */
-   len = strlen( lp);
-   padding( left_flag);
+   ctx->len = strlen( lp);
+   padding( ctx, ctx->left_flag);
    }
 
 /*---------------------------------------------------*/
@@ -91,22 +138,12 @@ static void outs( charptr lp)
 /* This routine moves a number to the output buffer  */
 /* as directed by the padding and positioning flags. */
 /*                                                   */
-static void outnum(unsigned int num, const int base)
+static void outnum( struct fmt_ctx *ctx, unsigned int num, const int negative, const int base)
 {
    charptr cp;
-   int negative;
    char outbuf[32];
    const char digits[] = "0123456789ABCDEF";
 
-   /* Check if number is negative                    */
-   /* NAK 2009-07-29 Negate the number only if it is not a hex value. */
-   if (num < 0L && base != 16L) {
-      negative = 1;
-      num = -num;
-      }
-   else
-      negative = 0;
-
    /* Build number (backwards) in outbuf             */
    cp = outbuf;
    do {
@@ -118,11 +155,23 @@ static void outnum(unsigned int num, const int base)
 
    /* Move the converted number to the buffer and    */
    /* add in the padding where needed.               */
-   len = strlen(outbuf);
-   padding( !left_flag);
+   ctx->len = strlen(outbuf);
+   padding( ctx, !ctx->left_flag);
    while (cp >= outbuf)
-      out_char( *cp--);
-   padding( left_flag);
+      out_char( ctx, *cp--);
+   padding( ctx, ctx->left_flag);
+}
+
+/*---------------------------------------------------*/
+/*                                                   */
+/* This routine prints a signed decimal number.      */
+/*                                                   */
+static void outdec( struct fmt_ctx *ctx, const long num)
+{
+   if (num < 0)
+      outnum( ctx, -(unsigned long)num, 1, 10);
+   else
+      outnum( ctx, num, 0, 10);
 }
 
 /*---------------------------------------------------*/
@@ -155,57 +204,43 @@ static int getnum( charptr* linep)
 /* added easily by following the examples shown for  */
 /* the supported formats.                            */
 /*                                                   */
-
-void esp_printf( const func_ptr f_ptr, charptr ctrl, ...)
-{
-  va_list args;
-  va_start(args, *ctrl);
-  esp_vprintf(f_ptr, ctrl, args);
-  va_end( args );
-  
-}
-
-void esp_vprintf( const func_ptr f_ptr, charptr ctrl, va_list argp)
+static void format( struct fmt_ctx *ctx, charptr ctrl, va_list argp)
 {
 
    int long_flag;
    int dot_flag;
 
    char ch;
-   //va_list argp;
-
-   //va_start( argp, ctrl);
-   out_char = f_ptr;
 
    for ( ; *ctrl; ctrl++) {
 
       /* move format string chars to buffer until a  */
       /* format control is found.                    */
       if (*ctrl != '%') {
-         out_char(*ctrl);
+         out_char( ctx, *ctrl);
          continue;
          }
 
       /* initialize all the flags for this format.   */
-      dot_flag   =
-      long_flag  =
-      left_flag  =
-      do_padding = 0;
-      pad_character = ' ';
-      num2=32767;
+      dot_flag        =
+      long_flag       =
+      ctx->left_flag  =
+      ctx->do_padding = 0;
+      ctx->pad_character = ' ';
+      ctx->num2 = 32767;
 
 try_next:
       ch = *(++ctrl);
 
       if (isdig((int)ch)) {
          if (dot_flag)
-            num2 = getnum(&ctrl);
+            ctx->num2 = getnum(&ctrl);
          else {
             if (ch == '0')
-               pad_character = '0';
+               ctx->pad_character = '0';
 
-            num1 = getnum(&ctrl);
-            do_padding = 1;
+            ctx->num1 = getnum(&ctrl);
+            ctx->do_padding = 1;
          }
          ctrl--;
          goto try_next;
@@ -213,11 +248,11 @@ try_next:
 
       switch (tolower((int)ch)) {
          case '%':
-              out_char( '%');
+              out_char( ctx, '%');
               continue;
 
          case '-':
-              left_flag = 1;
+              ctx->left_flag = 1;
               break;
 
          case '.':
@@ -227,46 +262,50 @@ try_next:
          case 'l':
               long_flag = 1;
               break;
-	
+
          case 'i':
          case 'd':
               if (long_flag || ch == 'D') {
-                 outnum( va_arg(argp, long), 10L);
+                 outdec( ctx, va_arg(argp, long));
                  continue;
                  }
               else {
-                 outnum( va_arg(argp, int), 10L);
+                 outdec( ctx, va_arg(argp, int));
                  continue;
                  }
+         case 'u':
+              outnum( ctx, va_arg(argp, unsigned int), 0, 10);
+              continue;
+
          case 'x':
-              outnum( (long)va_arg(argp, int), 16L);
+              outnum( ctx, va_arg(argp, unsigned int), 0, 16);
               continue;
 
          case 's':
-              outs( va_arg( argp, charptr));
+              outs( ctx, va_arg( argp, charptr));
               continue;
 
          case 'c':
-              out_char( va_arg( argp, int));
+              out_char( ctx, va_arg( argp, int));
               continue;
 
          case '\\':
               switch (*ctrl) {
                  case 'a':
-                      out_char( 0x07);
+                      out_char( ctx, 0x07);
                       break;
                  case 'h':
-                      out_char( 0x08);
+                      out_char( ctx, 0x08);
                       break;
                  case 'r':
-                      out_char( 0x0D);
+                      out_char( ctx, 0x0D);
                       break;
                  case 'n':
-                      out_char( 0x0D);
-                      out_char( 0x0A);
+                      out_char( ctx, 0x0D);
+                      out_char( ctx, 0x0A);
                       break;
                  default:
-                      out_char( *ctrl);
+                      out_char( ctx, *ctrl);
                       break;
                  }
               ctrl++;
@@ -277,8 +316,102 @@ try_next:
          }
       goto try_next;
       }
-   va_end( argp);
    }
 
 /*---------------------------------------------------*/
+/*                                                   */
+/* Print to a per-character sink such as putc. The   */
+/* sink still sees one call per character, but no    */
+/* state is shared between callers.                  */
+/*                                                   */
+void esp_vprintf( const func_ptr f_ptr, charptr ctrl, va_list argp)
+{
+   struct fmt_ctx ctx;
+
+   ctx.write = NULL;
+   ctx.out = f_ptr;
+   ctx.count = 0;
+   ctx.pos = 0;
+   format( &ctx, ctrl, argp);
+   flush( &ctx);
+   }
 
+void esp_printf( const func_ptr f_ptr, charptr ctrl, ...)
+{
+  va_list args;
+  va_start(args, ctrl);
+  esp_vprintf(f_ptr, ctrl, args);
+  va_end( args );
+}
+
+/*---------------------------------------------------*/
+/*                                                   */
+/* Print to a chunk sink: w gets the output in       */
+/* pieces of up to FMT_BUF_SIZE bytes. Returns the   */
+/* number of characters printed.                     */
+/*                                                   */
+int esp_vwprintf( const write_func w, charptr ctrl, va_list argp)
+{
+   struct fmt_ctx ctx;
+
+   ctx.write = w;
+   ctx.out = NULL;
+   ctx.count = 0;
+   ctx.pos = 0;
+   format( &ctx, ctrl, argp);
+   flush( &ctx);
+   return ctx.count;
+   }
+
+int esp_wprintf( const write_func w, charptr ctrl, ...)
+{
+  va_list args;
+  int n;
+  va_start(args, ctrl);
+  n = esp_vwprintf(w, ctrl, args);
+  va_end( args );
+  return n;
+}
+
+/*---------------------------------------------------*/
+/*                                                   */
+/* Format into buf, writing at most size bytes, the  */
+/* terminating NUL included. Returns the length the  */
+/* full output would have had, as C's snprintf does. */
+/*                                                   */
+int vsnprintf( char *buf, size_t size, charptr ctrl, va_list argp)
+{
+   struct fmt_ctx ctx;
+
+   ctx.write = NULL;
+   ctx.out = NULL;
+   ctx.str = buf;
+   ctx.size = size;
+   ctx.count = 0;
+   ctx.pos = 0;
+   format( &ctx, ctrl, argp);
+   if (size > 0)
+      buf[ctx.count < size ? ctx.count : size - 1] = 0;
+   return ctx.count;
+   }
+
+int snprintf( char *buf, size_t size, charptr ctrl, ...)
+{
+  va_list args;
+  int n;
+  va_start(args, ctrl);
+  n = vsnprintf(buf, size, ctrl, args);
+  va_end( args );
+  return n;
+}
+
+/* Unbounded; prefer snprintf.                       */
+void esp_sprintf( char *buf, char *ctrl, ...)
+{
+  va_list args;
+  va_start(args, ctrl);
+  vsnprintf(buf, 0x7FFFFFFF, ctrl, args);
+  va_end( args );
+}
+
+/*---------------------------------------------------*/
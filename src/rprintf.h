@@ -14,6 +14,9 @@ int isdig(int c); // hand-implemented alternative to isdigit(), which uses a bun
 
 typedef char* charptr;
 typedef int (*func_ptr)(int c);
+// Chunk sink for esp_wprintf(): gets formatted output a run at a time, so
+// a locked device pays one lock round trip per chunk, not per character.
+typedef void (*write_func)(const char *buf, size_t len);
 
 ///////////////////////////////////////////////////////////////////////////////
 ////  Common Prototype functions
@@ -21,6 +24,10 @@ typedef int (*func_ptr)(int c);
 void esp_sprintf(char *buf, char *ctrl, ...);
 void esp_vprintf( const func_ptr f_ptr, charptr ctrl, va_list argp);
 void esp_printf( const func_ptr f_ptr, charptr ctrl, ...);
+int esp_vwprintf( const write_func w, charptr ctrl, va_list argp);
+int esp_wprintf( const write_func w, charptr ctrl, ...);
+int vsnprintf( char *buf, size_t size, charptr ctrl, va_list argp);
+int snprintf( char *buf, size_t size, charptr ctrl, ...);
 void printk(charptr ctrl, ...);
 #endif
 
@@ -0,0 +1,227 @@
+#include <stdint.h>
+#include "serial.h"
+#include "io.h"
+#include "ring.h"
+#include "spinlock.h"
+#include "interrupt.h"
+#include "apic.h"
+
+// 16550 registers, as offsets from the base port
+#define UART_DATA   0   // THR on write, RBR on read (DLAB = 0)
+#define UART_IER    1
+#define UART_DLL    0   // divisor latch (DLAB = 1)
+#define UART_DLM    1
+#define UART_IIR    2   // on read
+#define UART_FCR    2   // on write
+#define UART_LCR    3
+#define UART_MCR    4
+#define UART_LSR    5
+#define UART_MSR    6
+
+#define IER_THRI    0x02   // interrupt when the transmit FIFO empties
+#define IIR_NO_INT  0x01
+#define IIR_ID_MASK 0x0E
+#define IIR_MSI     0x00
+#define IIR_THRI    0x02
+#define IIR_RDI     0x04
+#define IIR_RLSI    0x06
+#define IIR_TIMEOUT 0x0C
+#define FCR_ENABLE  0x01
+#define FCR_CLEAR   0x06   // reset both FIFOs
+#define FCR_TRIG_14 0xC0
+#define LCR_8N1     0x03
+#define LCR_DLAB    0x80
+#define MCR_DTR_RTS 0x03
+#define MCR_OUT2    0x08   // gates the UART's IRQ line on PC hardware
+#define LSR_THRE    0x20
+#define LSR_TEMT    0x40   // FIFO and shift register both empty
+
+#define BAUD_DIVISOR 1     // 115200 baud
+#define UART_FIFO_SIZE 16
+
+SPSC_RING_DECLARE(serial_tx_ring, uint8_t, 12)
+
+/*
+ * Transmit side. serial_putc() queues into tx_ring and returns; the THRE
+ * interrupt refills the 16-byte FIFO from it. tx_busy says a THRE
+ * interrupt is on its way, so producers only touch the UART themselves to
+ * start an idle transmitter. Producers on several CPUs and the handler are
+ * serialised by tx_lock; the ring is only the storage.
+ */
+static struct serial_tx_ring tx_ring;
+static struct spinlock tx_lock;
+static int tx_busy;
+static int irq_mode;   // 0 until serial_irq_init(): everything is polled
+
+static int tx_ready(void) {
+    return inb(COM1_PORT + UART_LSR) & LSR_THRE;
+}
+
+// Move up to one FIFO's worth from the ring to the UART. THR must be empty.
+static void fill_fifo_locked(void) {
+    uint8_t c;
+    for (int i = 0; i < UART_FIFO_SIZE; i++) {
+        if (serial_tx_ring_pop(&tx_ring, &c) != 0)
+            break;
+        outb(COM1_PORT + UART_DATA, c);
+    }
+    tx_busy = serial_tx_ring_count(&tx_ring) != 0 || !tx_ready();
+}
+
+// COM1 at 115200 8N1 with FIFOs on and interrupts off. This is what
+// QEMU's -serial shows; output is polled until serial_irq_init().
+void serial_init(void) {
+    outb(COM1_PORT + UART_IER, 0);
+    outb(COM1_PORT + UART_LCR, LCR_DLAB);
+    outb(COM1_PORT + UART_DLL, BAUD_DIVISOR & 0xFF);
+    outb(COM1_PORT + UART_DLM, BAUD_DIVISOR >> 8);
+    outb(COM1_PORT + UART_LCR, LCR_8N1);
+    outb(COM1_PORT + UART_FCR, FCR_ENABLE | FCR_CLEAR | FCR_TRIG_14);
+    outb(COM1_PORT + UART_MCR, MCR_DTR_RTS);
+}
+
+/*
+ * Switch transmit to the ring buffer and THRE interrupt (IRQ4). Call after
+ * apic_init() so the interrupt is routed through whichever controller is
+ * in charge.
+ */
+void serial_irq_init(void) {
+    uint32_t flags = spin_lock_irqsave(&tx_lock);
+
+    if (apic_enabled)
+        ioapic_route(COM1_IRQ, IRQ_COM1_VECTOR, lapic_id());
+    outb(COM1_PORT + UART_MCR, MCR_DTR_RTS | MCR_OUT2);
+    outb(COM1_PORT + UART_IER, IER_THRI);
+    irq_unmask(COM1_IRQ);
+    irq_mode = 1;
+
+    spin_unlock_irqrestore(&tx_lock, flags);
+}
+
+// Called from the IRQ4 handler. Services every pending cause; only THRE
+// is enabled, the others are read to acknowledge them.
+void serial_interrupt(void) {
+    uint8_t iir;
+
+    spin_lock(&tx_lock);
+    while (!((iir = inb(COM1_PORT + UART_IIR)) & IIR_NO_INT)) {
+        switch (iir & IIR_ID_MASK) {
+        case IIR_THRI:
+            fill_fifo_locked();
+            break;
+        case IIR_RDI:
+        case IIR_TIMEOUT:
+            inb(COM1_PORT + UART_DATA);
+            break;
+        case IIR_RLSI:
+            inb(COM1_PORT + UART_LSR);
+            break;
+        case IIR_MSI:
+            inb(COM1_PORT + UART_MSR);
+            break;
+        }
+    }
+    // Reading IIR acknowledges THRE, so a FIFO that drained while we were
+    // here raises no further interrupt; never leave tx_busy set without one.
+    if (tx_busy && tx_ready())
+        fill_fifo_locked();
+    spin_unlock(&tx_lock);
+}
+
+static void queue_locked(uint8_t c) {
+    // Full ring: wait for the UART rather than drop, one FIFO at a time.
+    while (serial_tx_ring_push(&tx_ring, c) != 0) {
+        while (!tx_ready())
+            cpu_relax();
+        fill_fifo_locked();
+    }
+}
+
+/*
+ * Usable as an esp_printf() sink. '\n' goes out as CRLF. Once interrupts
+ * are on this only queues, and blocks only when the ring is full.
+ */
+int serial_putc(int c) {
+    if (!irq_mode)
+        return serial_putc_polled(c);
+
+    uint32_t flags = spin_lock_irqsave(&tx_lock);
+    if (c == '\n')
+        queue_locked('\r');
+    queue_locked((uint8_t)c);
+    if (!tx_busy && tx_ready())
+        fill_fifo_locked();
+    spin_unlock_irqrestore(&tx_lock, flags);
+    return 0;
+}
+
+// write_func for COM1. Expands \n to \r\n; until serial_irq_init() switches
+// to the interrupt-driven ring it transmits by polling, without the lock.
+void serial_write(const char *buf, size_t len) {
+    if (!irq_mode) {
+        for (size_t i = 0; i < len; i++) {
+            serial_putc_polled(buf[i]);
+        }
+        return;
+    }
+
+    uint32_t flags = spin_lock_irqsave(&tx_lock);
+    for (size_t i = 0; i < len; i++) {
+        if (buf[i] == '\n')
+            queue_locked('\r');
+        queue_locked((uint8_t)buf[i]);
+    }
+    if (!tx_busy && tx_ready())
+        fill_fifo_locked();
+    spin_unlock_irqrestore(&tx_lock, flags);
+}
+
+// Wait until everything queued so far has left the UART. Interrupts must
+// be enabled once serial_irq_init() has run, since the THRE handler drains.
+void serial_flush(void) {
+    while (serial_tx_ring_count(&tx_ring) != 0)
+        cpu_relax();
+    while (!(inb(COM1_PORT + UART_LSR) & LSR_TEMT))
+        cpu_relax();
+}
+
+/*
+ * Polled transmit that takes no lock and bypasses the ring. For panic
+ * paths only, where interrupts are off and tx_lock may be held forever;
+ * call serial_panic_flush() first so queued output is not lost.
+ */
+int serial_putc_polled(int c) {
+    if (c == '\n')
+        serial_putc_polled('\r');
+    while (!tx_ready());
+    outb(COM1_PORT + UART_DATA, (uint8_t)c);
+    return 0;
+}
+
+// Drain whatever is queued with polling, ignoring tx_lock. Panic use only.
+void serial_panic_flush(void) {
+    uint8_t c;
+    irq_mode = 0;
+    outb(COM1_PORT + UART_IER, 0);
+    while (serial_tx_ring_pop(&tx_ring, &c) == 0) {
+        while (!tx_ready());
+        outb(COM1_PORT + UART_DATA, c);
+    }
+}
+
+/*
+ * Fatal error: stop this CPU's interrupts, drain queued output, print
+ * "PANIC: " and the message over COM1 with polling, and halt. Usable from
+ * any context, including with locks held. Never returns.
+ */
+void panic(charptr ctrl, ...) {
+    va_list args;
+
+    __asm__ __volatile__("cli");
+    serial_panic_flush();
+    va_start(args, ctrl);
+    esp_printf(serial_putc_polled, "PANIC: ");
+    esp_vprintf(serial_putc_polled, ctrl, args);
+    va_end(args);
+    halt_forever();
+}
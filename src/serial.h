@@ -0,0 +1,19 @@
+#ifndef SERIAL_H
+#define SERIAL_H
+
+#include "rprintf.h"
+
+#define COM1_PORT 0x3F8
+#define COM1_IRQ  4
+
+void serial_init(void);
+void serial_irq_init(void);
+void serial_interrupt(void);
+int serial_putc(int c);
+void serial_write(const char *buf, size_t len);
+void serial_flush(void);
+int serial_putc_polled(int c);
+void serial_panic_flush(void);
+void panic(charptr ctrl, ...);
+
+#endif
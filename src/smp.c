@@ -0,0 +1,128 @@
+#include <stdint.h>
+#include "smp.h"
+#include "apic.h"
+#include "atomic.h"
+#include "interrupt.h"
+#include "timer.h"
+#include "timing.h"
+#include "thread.h"
+#include "lib/string.h"
+#include "fpu.h"
+
+#define AP_TRAMPOLINE_BASE  0x8000
+#define ICR_INIT            0x4500   // INIT, level assert
+#define ICR_STARTUP         0x4600   // vector = start page (0x8000 >> 12)
+#define AP_BOOT_TIMEOUT_US  100000
+
+struct cpu cpus[MAX_CPUS];
+volatile uint32_t cpus_online = 0;
+
+static uint8_t ap_stacks[MAX_CPUS][AP_STACK_SIZE] __attribute__((aligned(16)));
+static struct cpu *volatile ap_booting;
+
+// Defined in ap_trampoline.s
+extern char ap_trampoline[], ap_trampoline_end[];
+extern uint32_t ap_cr3, ap_cr4, ap_stack, ap_entry;
+
+// Where a trampoline parameter lives in the copy at AP_TRAMPOLINE_BASE
+#define TRAMP_PARAM(sym) \
+    ((volatile uint32_t *)(AP_TRAMPOLINE_BASE + ((char *)&(sym) - ap_trampoline)))
+
+static void delay_us(uint32_t us) {
+    uint64_t end = rdtsc() + (uint64_t)(tsc_khz / 1000) * us;
+    while (rdtsc() < end)
+        cpu_relax();
+}
+
+/*
+ * Give the calling CPU its own GDT copy and TSS, reload the segment
+ * registers and TR from it, load the shared IDT and point this CPU's
+ * SYSENTER MSRs at its TSS. From here on this_cpu() returns c.
+ */
+void cpu_init(struct cpu *c, uint32_t stack_top) {
+    extern struct gdt_entry_bits gdt[];
+
+    for (int i = 0; i < GDT_ENTRIES; i++) {
+        c->gdt[i] = gdt[i];
+    }
+    write_tss(&c->gdt[5], &c->tss, stack_top);
+    c->gdt_desc.sz = sizeof(c->gdt) - 1;
+    c->gdt_desc.addr = (uint32_t)c->gdt;
+
+    asm volatile("lgdt %0\n"
+                 "ljmp $0x8, $1f\n"
+                 "1:\n"
+                 "mov $0x10, %%eax\n"
+                 "mov %%ax, %%ds\n"
+                 "mov %%ax, %%ss\n"
+                 "mov %%ax, %%es\n"
+                 "mov %%ax, %%fs\n"
+                 "mov %%ax, %%gs\n"
+                 : : "m"(c->gdt_desc) : "eax", "memory");
+    tss_flush(0x2b);
+    load_idt();
+    init_sysenter(&c->tss);
+}
+
+// First C code an AP runs, on its own stack with paging already on.
+static void ap_main(void) {
+    struct cpu *c = ap_booting;
+
+    cpu_init(c, (uint32_t)(ap_stacks[c->id] + AP_STACK_SIZE));
+    fpu_init();
+    lapic_enable();
+    __atomic_store_n(&c->online, 1, __ATOMIC_RELEASE);
+    atomic_fetch_add(&cpus_online, 1);
+    sched_start_ap();
+}
+
+/*
+ * Start every other CPU the MADT listed with INIT-SIPI-SIPI, one at a
+ * time since they share the trampoline. Call on the BSP after apic_init()
+ * and sched_init(); each AP joins the scheduler as soon as it is up.
+ * Returns how many CPUs, the BSP included, have checked in.
+ */
+int smp_boot_aps(void) {
+    struct cpu *bsp = &cpus[0];
+    uint32_t cr3, cr4;
+
+    bsp->apic_id = apic_enabled ? lapic_id() : 0;
+    bsp->online = 1;
+    cpus_online = 1;
+    if (!apic_enabled)
+        return cpus_online;
+
+    // Real-mode code must sit below 1 MiB; low memory is identity mapped.
+    memcpy((void *)AP_TRAMPOLINE_BASE, ap_trampoline, ap_trampoline_end - ap_trampoline);
+    asm volatile("mov %%cr3, %0" : "=r"(cr3));
+    asm volatile("mov %%cr4, %0" : "=r"(cr4));
+    *TRAMP_PARAM(ap_cr3) = cr3;
+    *TRAMP_PARAM(ap_cr4) = cr4;
+    *TRAMP_PARAM(ap_entry) = (uint32_t)ap_main;
+
+    int n = 1;
+    for (int i = 0; i < num_cpus && n < MAX_CPUS; i++) {
+        if (cpu_apic_ids[i] == bsp->apic_id)
+            continue;
+
+        struct cpu *c = &cpus[n];
+        c->id = n;
+        c->apic_id = cpu_apic_ids[i];
+        ap_booting = c;
+        *TRAMP_PARAM(ap_stack) = (uint32_t)(ap_stacks[n] + AP_STACK_SIZE);
+
+        lapic_send_ipi(c->apic_id, ICR_INIT);
+        delay_us(10000);
+        for (int k = 0; k < 2 && !c->online; k++) {
+            lapic_send_ipi(c->apic_id, ICR_STARTUP | (AP_TRAMPOLINE_BASE >> 12));
+            delay_us(200);
+        }
+
+        for (uint32_t waited = 0; waited < AP_BOOT_TIMEOUT_US && !c->online; waited += 100) {
+            delay_us(100);
+        }
+        if (c->online)
+            n++;
+    }
+    return cpus_online;
+}
@@ -0,0 +1,47 @@
+#ifndef SMP_H
+#define SMP_H
+
+#include <stdint.h>
+#include "interrupt.h"
+#include "apic.h"
+
+struct thread;
+
+#define GDT_ENTRIES     6
+#define AP_STACK_SIZE   16384
+
+/*
+ * Per-CPU area. Every CPU runs on its own copy of the GDT, whose TSS
+ * descriptor points at this CPU's TSS; since the GDT copy is the first
+ * member, the base sgdt reports is the address of the struct itself.
+ */
+struct cpu {
+    struct gdt_entry_bits gdt[GDT_ENTRIES];
+    struct seg_desc gdt_desc;
+    struct tss_entry tss;
+    int id;                      // index into cpus[], 0 is the BSP
+    uint8_t apic_id;
+    volatile int online;
+    struct thread *current_thread;  // thread running on this CPU, see current
+    uint32_t ticks;              // timer interrupts taken
+    uint32_t irq_count;          // device interrupts taken
+    struct thread *fpu_owner;    // whose FPU state the registers hold, see fpu.c
+    uint32_t kernel_fpu_flags;   // EFLAGS saved by kernel_fpu_begin()
+    int kernel_fpu_active;       // inside kernel_fpu_begin()/end(), which do not nest
+    volatile uint32_t idle;      // halted in the idle loop; cleared by whoever wakes it
+    volatile int nohz;           // periodic tick stopped while idle, see timer.c
+};
+
+extern struct cpu cpus[MAX_CPUS];
+extern volatile uint32_t cpus_online;
+
+static inline struct cpu *this_cpu(void) {
+    struct seg_desc d;
+    __asm__ __volatile__("sgdt %0" : "=m"(d));
+    return (struct cpu *)d.addr;
+}
+
+void cpu_init(struct cpu *c, uint32_t stack_top);
+int smp_boot_aps(void);
+
+#endif
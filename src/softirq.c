@@ -0,0 +1,86 @@
+#include <stdint.h>
+#include "softirq.h"
+#include "interrupt.h"
+#include "atomic.h"
+#include "smp.h"
+
+// Batches run per softirq_run(); anything queued after that waits for the
+// next interrupt exit so a flood of work cannot starve threads.
+#define SOFTIRQ_MAX_PASSES 8
+
+// Per-CPU FIFO of queued work. Only its own CPU touches it, with IRQs off.
+struct softirq_cpu {
+    struct work *head;
+    struct work *tail;
+    int active;                  // softirq_run() is on this CPU's stack
+} __attribute__((aligned(64)));
+
+static struct softirq_cpu softirq_cpus[MAX_CPUS];
+
+void work_init(struct work *w, work_fn fn, void *arg) {
+    w->next = 0;
+    w->fn = fn;
+    w->arg = arg;
+    w->pending = 0;
+}
+
+/*
+ * Queue w on the calling CPU. Safe from hard IRQ context. Returns 0 if w
+ * was already pending, in which case the earlier queueing covers this one.
+ */
+int work_queue(struct work *w) {
+    if (atomic_xchg(&w->pending, 1))
+        return 0;
+
+    uint32_t flags = irq_save();
+    struct softirq_cpu *sc = &softirq_cpus[this_cpu()->id];
+    w->next = 0;
+    if (sc->tail)
+        sc->tail->next = w;
+    else
+        sc->head = w;
+    sc->tail = w;
+    irq_restore(flags);
+    return 1;
+}
+
+/*
+ * Run this CPU's queued work with interrupts enabled. Called from
+ * irq_exit() with interrupts disabled, and returns with them disabled.
+ * Does nothing when an interrupt arrives while a batch is already
+ * running; the outer call picks up whatever it queued.
+ */
+void softirq_run(void) {
+    struct softirq_cpu *sc = &softirq_cpus[this_cpu()->id];
+
+    if (sc->active || !sc->head)
+        return;
+
+    sc->active = 1;
+    for (int pass = 0; pass < SOFTIRQ_MAX_PASSES && sc->head; pass++) {
+        struct work *w = sc->head;
+        sc->head = 0;
+        sc->tail = 0;
+
+        asm volatile("sti");
+        while (w) {
+            struct work *next = w->next;
+            w->next = 0;
+            __atomic_store_n(&w->pending, 0, __ATOMIC_RELEASE);
+            w->fn(w, w->arg);
+            w = next;
+        }
+        asm volatile("cli");
+    }
+    sc->active = 0;
+}
+
+// True if work is queued on this CPU and will run at the next irq_exit()
+int softirq_pending(void) {
+    return softirq_cpus[this_cpu()->id].head != 0;
+}
+
+// True while this CPU is running deferred work; it must not be preempted.
+int in_softirq(void) {
+    return softirq_cpus[this_cpu()->id].active;
+}
@@ -0,0 +1,27 @@
+#ifndef SOFTIRQ_H
+#define SOFTIRQ_H
+
+#include <stdint.h>
+
+/*
+ * Deferred work ("bottom halves"). A hard IRQ handler queues a work item
+ * and returns; on the way out of the interrupt, softirq_run() runs every
+ * item queued on that CPU with interrupts enabled, in one batch.
+ */
+struct work;
+typedef void (*work_fn)(struct work *w, void *arg);
+
+struct work {
+    struct work *next;
+    work_fn fn;
+    void *arg;
+    volatile uint32_t pending;   // queued and not yet started
+};
+
+void work_init(struct work *w, work_fn fn, void *arg);
+int work_queue(struct work *w);
+void softirq_run(void);
+int in_softirq(void);
+int softirq_pending(void);
+
+#endif
@@ -0,0 +1,47 @@
+#ifndef SPINLOCK_H
+#define SPINLOCK_H
+
+#include <stdint.h>
+#include "atomic.h"
+#include "interrupt.h"
+
+/*
+ * Ticket spinlock: each locker takes the next ticket and waits until owner
+ * reaches it, so CPUs get the lock in FIFO order. A zero-initialized lock
+ * is unlocked.
+ */
+struct spinlock {
+    volatile uint32_t next;
+    volatile uint32_t owner;
+};
+
+static inline void spin_lock(struct spinlock *l) {
+    uint32_t ticket = atomic_fetch_add(&l->next, 1);
+    while (__atomic_load_n(&l->owner, __ATOMIC_ACQUIRE) != ticket) {
+        cpu_relax();
+    }
+}
+
+static inline void spin_unlock(struct spinlock *l) {
+    __atomic_store_n(&l->owner, l->owner + 1, __ATOMIC_RELEASE);
+}
+
+// Take the lock only if it is free right now. Returns 1 if it was taken.
+static inline int spin_trylock(struct spinlock *l) {
+    uint32_t owner = __atomic_load_n(&l->owner, __ATOMIC_ACQUIRE);
+    return atomic_cmpxchg(&l->next, owner, owner + 1) == owner;
+}
+
+// For data also touched from interrupt handlers on the same CPU
+static inline uint32_t spin_lock_irqsave(struct spinlock *l) {
+    uint32_t flags = irq_save();
+    spin_lock(l);
+    return flags;
+}
+
+static inline void spin_unlock_irqrestore(struct spinlock *l, uint32_t flags) {
+    spin_unlock(l);
+    irq_restore(flags);
+}
+
+#endif
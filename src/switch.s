@@ -0,0 +1,41 @@
+;=============================================================================
+; Kernel thread context switch
+;
+; C Prototype:
+; void switch_context(uint32_t *save_esp, uint32_t load_esp)
+;
+; Saves the callee-saved registers on the current stack, stores the stack
+; pointer through save_esp, loads load_esp and pops the next thread's
+; registers. The ret then resumes the next thread wherever it last called
+; switch_context (or in its start routine, for a brand new thread).
+;
+; Stack layout after the pushes:
+; |-------------------------------|
+; |           load_esp            |  [24+esp]
+; |-------------------------------|
+; |           save_esp            |  [20+esp]
+; |-------------------------------|
+; |         Return Address        |  [16+esp]
+; |-------------------------------|
+; |       ebp, ebx, esi, edi      |  [esp .. 12+esp]
+; |-------------------------------|
+;
+;=============================================================================
+    [BITS 32]
+    global switch_context
+
+switch_context:
+    push ebp
+    push ebx
+    push esi
+    push edi
+
+    mov eax, [esp+20]
+    mov [eax], esp
+    mov esp, [esp+24]
+
+    pop edi
+    pop esi
+    pop ebx
+    pop ebp
+    ret
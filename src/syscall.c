@@ -0,0 +1,38 @@
+#include <stdint.h>
+#include "syscall.h"
+#include "thread.h"
+#include "timer.h"
+
+int sysenter_supported = 0;
+
+static int sys_null(uint32_t a1, uint32_t a2, uint32_t a3) {
+    return 0;
+}
+
+static int sys_exit(uint32_t a1, uint32_t a2, uint32_t a3) {
+    thread_exit();
+    return 0;
+}
+
+static int sys_yield(uint32_t a1, uint32_t a2, uint32_t a3) {
+    thread_yield();
+    return 0;
+}
+
+static int sys_ticks(uint32_t a1, uint32_t a2, uint32_t a3) {
+    return ticks;
+}
+
+static const syscall_fn syscall_table[NR_SYSCALLS] = {
+    [SYS_NULL]  = sys_null,
+    [SYS_EXIT]  = sys_exit,
+    [SYS_YIELD] = sys_yield,
+    [SYS_TICKS] = sys_ticks,
+};
+
+// Common C entry for int 0x80 and sysenter. Runs with interrupts disabled.
+int syscall_dispatch(uint32_t nr, uint32_t a1, uint32_t a2, uint32_t a3) {
+    if (nr >= NR_SYSCALLS)
+        return -1;
+    return syscall_table[nr](a1, a2, a3);
+}
@@ -0,0 +1,34 @@
+#ifndef SYSCALL_H
+#define SYSCALL_H
+
+#include <stdint.h>
+
+/*
+ * System call ABI. Both entry paths land in syscall_dispatch():
+ *
+ *   int 0x80:  eax = number, ebx/ecx/edx = args, result in eax
+ *   sysenter:  eax = number, ebx/esi/edi = args, result in eax,
+ *              ecx = user esp and edx = user eip to return to
+ *
+ * The numbers are also used by syscall_entry.s; keep them in sync.
+ */
+#define SYS_NULL     0
+#define SYS_EXIT     1
+#define SYS_YIELD    2
+#define SYS_TICKS    3
+#define NR_SYSCALLS  4
+
+typedef int (*syscall_fn)(uint32_t a1, uint32_t a2, uint32_t a3);
+
+extern int sysenter_supported;
+
+int syscall_dispatch(uint32_t nr, uint32_t a1, uint32_t a2, uint32_t a3);
+
+// Implemented in syscall_entry.s
+void syscall_int80_entry(void);
+void sysenter_entry(void);
+void enter_user_mode(uint32_t eip, uint32_t user_esp, uint32_t kernel_esp);
+extern char user_syscall_bench[];
+extern char user_syscall_bench_end[];
+
+#endif
@@ -0,0 +1,129 @@
+;=============================================================================
+; System call entry points and the jump to ring 3
+;
+; Both entries build a cdecl call to
+;     int syscall_dispatch(uint32_t nr, uint32_t a1, uint32_t a2, uint32_t a3)
+; and return its result in eax. ebx/esi/edi/ebp survive because the C code
+; preserves them; ecx and edx are saved by hand.
+;
+; int 0x80:  eax = nr, ebx/ecx/edx = args. The CPU has already switched to
+;            tss.esp0 and pushed an iret frame.
+; sysenter:  eax = nr, ebx/esi/edi = args, ecx = user esp, edx = user eip.
+;            The CPU loads esp from MSR_SYSENTER_ESP, which points at
+;            tss.esp0, so the first instruction fetches the real stack.
+;
+; Syscall numbers must match syscall.h.
+;=============================================================================
+    [BITS 32]
+    global syscall_int80_entry
+    global sysenter_entry
+    global enter_user_mode
+    global user_syscall_bench
+    global user_syscall_bench_end
+    extern syscall_dispatch
+
+%define USER_CS  0x1b
+%define USER_DS  0x23
+%define SYS_NULL 0
+%define SYS_EXIT 1
+
+syscall_int80_entry:
+    push ecx
+    push edx
+    push edx                ; a3
+    push ecx                ; a2
+    push ebx                ; a1
+    push eax                ; nr
+    call syscall_dispatch
+    add esp, 16
+    pop edx
+    pop ecx
+    iretd
+
+sysenter_entry:
+    mov esp, [esp]          ; MSR_SYSENTER_ESP = &tss.esp0
+    push ecx                ; user esp
+    push edx                ; user eip
+    push edi                ; a3
+    push esi                ; a2
+    push ebx                ; a1
+    push eax                ; nr
+    call syscall_dispatch
+    add esp, 16
+    pop edx
+    pop ecx
+    sti                     ; takes effect after sysexit
+    sysexit
+
+;-----------------------------------------------------------------------------
+; void enter_user_mode(uint32_t eip, uint32_t user_esp, uint32_t kernel_esp)
+;
+; Drop to ring 3 at eip with interrupts enabled. Everything on the current
+; kernel stack is discarded: esp is reset to kernel_esp (the top of the
+; thread's stack, i.e. tss.esp0) before building the iret frame. Never returns.
+;-----------------------------------------------------------------------------
+enter_user_mode:
+    mov eax, [esp+4]
+    mov ecx, [esp+8]
+    mov esp, [esp+12]
+    mov dx, USER_DS
+    mov ds, dx
+    mov es, dx
+    mov fs, dx
+    mov gs, dx
+    push USER_DS            ; ss
+    push ecx                ; esp
+    push 0x202              ; eflags: IF set
+    push USER_CS            ; cs
+    push eax                ; eip
+    iretd
+
+;-----------------------------------------------------------------------------
+; Ring 3 body of the null-syscall benchmark. It is copied into a user page,
+; so it must be position independent.
+;
+; On entry [esp] and [esp+4] hold the int 0x80 and sysenter iteration
+; counts; they are overwritten with the cycles (low 32 bits) each loop took
+; before the thread exits.
+;-----------------------------------------------------------------------------
+user_syscall_bench:
+    mov ebp, [esp]
+    rdtsc
+    mov esi, eax
+    test ebp, ebp
+    jz .int80_done
+.int80_loop:
+    mov eax, SYS_NULL
+    int 0x80
+    dec ebp
+    jnz .int80_loop
+.int80_done:
+    rdtsc
+    sub eax, esi
+    mov [esp], eax
+
+    mov ebp, [esp+4]
+    call .here
+.here:
+    pop edi
+    add edi, .sysenter_ret - .here
+    rdtsc
+    mov esi, eax
+    test ebp, ebp
+    jz .sysenter_done
+.sysenter_loop:
+    mov eax, SYS_NULL
+    mov edx, edi            ; resume at .sysenter_ret
+    mov ecx, esp
+    sysenter
+.sysenter_ret:
+    dec ebp
+    jnz .sysenter_loop
+.sysenter_done:
+    rdtsc
+    sub eax, esi
+    mov [esp+4], eax
+
+    mov eax, SYS_EXIT
+    int 0x80
+user_syscall_bench_end:
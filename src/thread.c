@@ -0,0 +1,488 @@
+#include <stdint.h>
+#include "thread.h"
+#include "interrupt.h"
+#include "syscall.h"
+#include "spinlock.h"
+#include "apic.h"
+#include "atomic.h"
+#include "softirq.h"
+
+static struct thread threads[MAX_THREADS];
+static uint8_t thread_stacks[MAX_THREADS][THREAD_STACK_SIZE] __attribute__((aligned(16)));
+
+
+/*
+ * Every CPU owns a run queue: one FIFO per priority plus a bitmap of
+ * non-empty ones, so pick-next is a single bit scan. The owner takes
+ * threads from the head; an idle CPU steals from the tail of someone
+ * else's queue. Lock order: a run queue lock is never held while taking
+ * another one (stealing only trylocks).
+ */
+struct runq {
+    struct spinlock lock;
+    struct thread *head[NUM_PRIORITIES];
+    struct thread *tail[NUM_PRIORITIES];
+    uint32_t bitmap;
+    volatile int nr_ready;
+    volatile int need_resched;
+    struct thread *idle;             // runs when nothing else can
+    struct thread *switched_from;    // its on_cpu is cleared after the switch
+} __attribute__((aligned(64)));
+
+static struct runq runqs[MAX_CPUS];
+static struct spinlock threads_lock;   // slot allocation in threads[]
+
+static struct runq *this_rq(void) {
+    return &runqs[this_cpu()->id];
+}
+
+static void runq_push(struct runq *rq, struct thread *t) {
+    int prio = t->priority;
+
+    t->next = 0;
+    t->prev = rq->tail[prio];
+    if (rq->tail[prio])
+        rq->tail[prio]->next = t;
+    else
+        rq->head[prio] = t;
+    rq->tail[prio] = t;
+    rq->bitmap |= 1u << prio;
+    rq->nr_ready++;
+}
+
+static void runq_remove(struct runq *rq, struct thread *t) {
+    int prio = t->priority;
+
+    if (t->prev)
+        t->prev->next = t->next;
+    else
+        rq->head[prio] = t->next;
+    if (t->next)
+        t->next->prev = t->prev;
+    else
+        rq->tail[prio] = t->prev;
+    if (!rq->head[prio])
+        rq->bitmap &= ~(1u << prio);
+    t->next = 0;
+    t->prev = 0;
+    rq->nr_ready--;
+}
+
+// Most urgent priority with a runnable thread (bitmap must be non-empty)
+static int runq_best(struct runq *rq) {
+    return __builtin_ctz(rq->bitmap);
+}
+
+/*
+ * Take the most urgent stealable thread from the tail of another CPU's
+ * queue. Threads still being switched out (on_cpu) and pinned threads stay
+ * put. Busy queues are only trylocked so idle CPUs never pile up on them.
+ */
+static struct thread *steal(int self) {
+    int n = cpus_online;
+
+    for (int i = 1; i < n; i++) {
+        struct runq *rq = &runqs[(self + i) % n];
+        struct thread *t = 0;
+
+        if (rq->nr_ready == 0 || !spin_trylock(&rq->lock))
+            continue;
+        for (uint32_t bits = rq->bitmap; bits && !t; bits &= bits - 1) {
+            for (t = rq->tail[__builtin_ctz(bits)]; t; t = t->prev) {
+                if (!t->pinned && !t->on_cpu)
+                    break;
+            }
+        }
+        if (t)
+            runq_remove(rq, t);
+        spin_unlock(&rq->lock);
+        if (t)
+            return t;
+    }
+    return 0;
+}
+
+// Runs on the new thread right after a switch, once prev's context is saved.
+static void finish_switch(void) {
+    struct runq *rq = this_rq();
+    __atomic_store_n(&rq->switched_from->on_cpu, 0, __ATOMIC_RELEASE);
+}
+
+/*
+ * Switch to the most urgent ready thread on this CPU, stealing one if the
+ * local queue is empty, or to this CPU's idle thread. Must be called with
+ * interrupts disabled. A still-running caller goes to the back of its
+ * queue, but only if something at least as urgent is waiting; otherwise it
+ * keeps the CPU.
+ */
+void schedule(void) {
+    struct cpu *c = this_cpu();
+    struct runq *rq = &runqs[c->id];
+    struct thread *prev = c->current_thread;
+    struct thread *next = 0;
+
+    spin_lock(&rq->lock);
+    rq->need_resched = 0;
+    if (prev->state == THREAD_RUNNING && prev != rq->idle) {
+        if (rq->bitmap == 0 || runq_best(rq) > prev->priority) {
+            spin_unlock(&rq->lock);
+            return;
+        }
+        prev->state = THREAD_READY;
+        runq_push(rq, prev);
+    }
+    if (rq->bitmap) {
+        next = rq->head[runq_best(rq)];
+        runq_remove(rq, next);
+    }
+    spin_unlock(&rq->lock);
+
+    if (!next)
+        next = steal(c->id);
+    if (!next) {
+        if (prev->state == THREAD_RUNNING)
+            return;
+        next = rq->idle;
+    }
+
+    int migrated = next->cpu != c->id;
+    next->state = THREAD_RUNNING;
+    next->slice = THREAD_SLICE_TICKS;
+    next->cpu = c->id;
+    if (next == prev)
+        return;
+
+    next->on_cpu = 1;
+    rq->switched_from = prev;
+    c->current_thread = next;
+    if (next->stack)
+        tss_set_kernel_stack((uint32_t)(next->stack + THREAD_STACK_SIZE));
+    if (next->as != prev->as)
+        as_switch(next->as ? next->as : &kernel_address_space);
+    else if (migrated)
+        flush_tlb();   // this CPU may hold stale user entries for next->as
+    fpu_switch(prev, next);
+    switch_context(&prev->esp, next->esp);
+    finish_switch();
+}
+
+// First thing a new thread runs, via the ret in switch_context.
+static void thread_start(void) {
+    finish_switch();
+    asm volatile("sti");
+    current->fn(current->arg);
+    thread_exit();
+}
+
+/*
+ * Wake CPU id if it is halted in the idle loop. Only the caller that
+ * clears its idle flag sends the IPI, so a burst of wake-ups costs one.
+ */
+void sched_kick_cpu(int id) {
+    if (id == this_cpu()->id || !cpus[id].idle)
+        return;
+    if (atomic_xchg(&cpus[id].idle, 0))
+        lapic_send_ipi(cpus[id].apic_id, ICR_FIXED | RESCHED_VECTOR);
+}
+
+// Something was just queued on target: wake it, or if it is busy and has
+// work to spare, one halted CPU that can steal it.
+static void kick_idle(int target) {
+    smp_mb();   // queue update before the idle flags; pairs with idle_loop()
+    if (cpus[target].idle) {
+        sched_kick_cpu(target);
+        return;
+    }
+    if (runqs[target].nr_ready == 0)
+        return;
+    for (uint32_t i = 0; i < cpus_online; i++) {
+        if (cpus[i].idle) {
+            sched_kick_cpu(i);
+            return;
+        }
+    }
+}
+
+// True if this CPU could run something: its own queue or a steal.
+static int work_waiting(void) {
+    for (uint32_t i = 0; i < cpus_online; i++) {
+        if (runqs[i].nr_ready)
+            return 1;
+    }
+    return 0;
+}
+
+/*
+ * Runs when this CPU has nothing queued. Looks for local or stealable
+ * work, then halts until an interrupt: a device, its tick, or a
+ * reschedule IPI from a CPU that queued work. The idle flag is raised
+ * before the last look at the queues so a concurrent kick_idle() either
+ * sees it or its work is seen here. The tick stops while halted (see
+ * timer_nohz_enter()); sti; hlt is atomic, so an interrupt arriving after
+ * the checks still ends the hlt.
+ */
+static void idle_loop(void *arg) {
+    struct cpu *c = this_cpu();
+
+    while (1) {
+        thread_yield();
+
+        irq_save();
+        if (softirq_pending() || this_rq()->need_resched) {
+            asm volatile("sti");
+            continue;
+        }
+        atomic_xchg(&c->idle, 1);
+        if (work_waiting()) {
+            c->idle = 0;
+            asm volatile("sti");
+            continue;
+        }
+        timer_nohz_enter();
+        asm volatile("sti; hlt");
+        c->idle = 0;
+    }
+}
+
+// Claim a thread slot and build its first frame. The thread is not queued.
+static struct thread *thread_alloc(const char *name, thread_fn fn, void *arg, int priority) {
+    struct thread *t = 0;
+
+    spin_lock(&threads_lock);
+    for (int i = 1; i < MAX_THREADS; i++) {
+        if (threads[i].state == THREAD_UNUSED ||
+            (threads[i].state == THREAD_DEAD && !threads[i].on_cpu)) {
+            t = &threads[i];
+            t->id = i;
+            t->stack = thread_stacks[i];
+            t->state = THREAD_READY;
+            break;
+        }
+    }
+    spin_unlock(&threads_lock);
+    if (!t)
+        return 0;
+
+    t->name = name;
+    t->fn = fn;
+    t->arg = arg;
+    t->priority = priority;
+    t->slice = THREAD_SLICE_TICKS;
+    t->as = 0;
+    t->cpu = this_cpu()->id;
+    t->pinned = 0;
+    t->on_cpu = 0;
+    t->fpu_used = 0;
+    t->fpu_cpu = -1;
+    timer_setup(&t->sleep_timer, 0, 0);
+
+    // Initial frame popped by switch_context: edi, esi, ebx, ebp, then
+    // "return" into thread_start, which itself sees a null return address.
+    uint32_t *sp = (uint32_t *)(t->stack + THREAD_STACK_SIZE);
+    *--sp = 0;
+    *--sp = (uint32_t)thread_start;
+    *--sp = 0;   // ebp
+    *--sp = 0;   // ebx
+    *--sp = 0;   // esi
+    *--sp = 0;   // edi
+    t->esp = (uint32_t)sp;
+    return t;
+}
+
+/*
+ * Turn the boot flow of control into thread 0 ("main") on the BSP and give
+ * the BSP its idle thread. Call before smp_boot_aps().
+ */
+void sched_init(void) {
+    struct thread *boot = &threads[0];
+    struct thread *idle;
+
+    boot->state = THREAD_RUNNING;
+    boot->priority = THREAD_PRIO_DEFAULT;
+    boot->slice = THREAD_SLICE_TICKS;
+    boot->id = 0;
+    boot->name = "main";
+    boot->stack = 0;      // keeps running on the boot stack
+    boot->cpu = this_cpu()->id;
+    boot->on_cpu = 1;
+    boot->fpu_cpu = -1;
+    current = boot;
+
+    idle = thread_alloc("idle", idle_loop, 0, THREAD_PRIO_IDLE);
+    idle->pinned = 1;
+    this_rq()->idle = idle;
+}
+
+/*
+ * Entered by each AP once it is online, with interrupts off: its boot
+ * stack becomes its idle thread, then its LAPIC timer starts ticking and
+ * it goes looking for work. Never returns.
+ */
+void sched_start_ap(void) {
+    struct thread *idle = thread_alloc("idle", idle_loop, 0, THREAD_PRIO_IDLE);
+
+    if (!idle) {
+        while (1)
+            asm volatile("cli; hlt");
+    }
+    idle->stack = 0;      // keeps running on the AP boot stack
+    idle->state = THREAD_RUNNING;
+    idle->pinned = 1;
+    idle->on_cpu = 1;
+    this_rq()->idle = idle;
+    current = idle;
+
+    lapic_timer_start();
+    asm volatile("sti");
+    idle_loop(0);
+}
+
+// Called from the timer interrupt (after EOI): charge the tick to the running
+// thread. The round-robin switch on slice expiry happens in sched_preempt().
+void sched_tick(void) {
+    if (!current)
+        return;
+
+    if (--current->slice <= 0) {
+        current->slice = THREAD_SLICE_TICKS;
+        this_rq()->need_resched = 1;
+    }
+}
+
+// Called on the way out of an interrupt handler, with interrupts disabled.
+void sched_preempt(void) {
+    if (current && this_rq()->need_resched)
+        schedule();
+}
+
+static struct thread *spawn(const char *name, thread_fn fn, void *arg, int priority, int pinned) {
+    uint32_t flags = irq_save();
+    struct thread *t = thread_alloc(name, fn, arg, priority);
+    struct runq *rq = this_rq();
+
+    if (!t) {
+        irq_restore(flags);
+        return 0;
+    }
+
+    t->pinned = pinned;
+    spin_lock(&rq->lock);
+    runq_push(rq, t);
+    spin_unlock(&rq->lock);
+    if (!pinned)
+        kick_idle(this_cpu()->id);
+    if (current && priority < current->priority)
+        schedule();
+
+    irq_restore(flags);
+    return t;
+}
+
+// New threads start on the creating CPU's queue; idle CPUs steal them.
+struct thread *thread_create(const char *name, thread_fn fn, void *arg, int priority) {
+    return spawn(name, fn, arg, priority, 0);
+}
+
+// Like thread_create(), but the thread only ever runs on the calling CPU.
+struct thread *thread_create_pinned(const char *name, thread_fn fn, void *arg, int priority) {
+    return spawn(name, fn, arg, priority, 1);
+}
+
+void thread_yield(void) {
+    uint32_t flags = irq_save();
+    schedule();
+    irq_restore(flags);
+}
+
+// Sleep until someone calls thread_wake() on the current thread.
+void thread_block(void) {
+    uint32_t flags = irq_save();
+    current->state = THREAD_BLOCKED;
+    schedule();
+    irq_restore(flags);
+}
+
+/*
+ * Block with lock held and irq_save()'d as flags, releasing it only once
+ * the thread is marked blocked: a waker that takes lock after seeing the
+ * condition we checked under it cannot be missed.
+ */
+void thread_block_unlock(struct spinlock *lock, uint32_t flags) {
+    current->state = THREAD_BLOCKED;
+    spin_unlock(lock);
+    schedule();
+    irq_restore(flags);
+}
+
+/*
+ * Make a blocked thread runnable. Safe from interrupt handlers and from
+ * any CPU. The thread goes back to the CPU it last ran on, where its cache
+ * is warm, unless that queue is clearly longer than ours. A more urgent
+ * thread than the one running there preempts it when that CPU next leaves
+ * an interrupt.
+ */
+void thread_wake(struct thread *t) {
+    uint32_t flags = irq_save();
+
+    if (t->state != THREAD_BLOCKED) {
+        irq_restore(flags);
+        return;
+    }
+    // It may have just blocked on another CPU that is still switching away
+    while (__atomic_load_n(&t->on_cpu, __ATOMIC_ACQUIRE))
+        cpu_relax();
+    if (atomic_cmpxchg((volatile uint32_t *)&t->state, THREAD_BLOCKED, THREAD_READY) != THREAD_BLOCKED) {
+        irq_restore(flags);
+        return;
+    }
+
+    int target = t->cpu;
+    struct runq *local = this_rq();
+    if (!t->pinned && runqs[target].nr_ready > local->nr_ready + 1)
+        target = this_cpu()->id;
+
+    struct runq *rq = &runqs[target];
+    spin_lock(&rq->lock);
+    t->cpu = target;
+    runq_push(rq, t);
+    spin_unlock(&rq->lock);
+    if (t->priority < cpus[target].current_thread->priority)
+        rq->need_resched = 1;
+    kick_idle(target);
+    irq_restore(flags);
+}
+
+static void sleep_timer_fn(struct timer *timer, void *arg) {
+    thread_wake(arg);
+}
+
+void thread_sleep_ms(uint32_t ms) {
+    uint32_t flags = irq_save();
+    struct thread *self = current;
+
+    // Blocked before the timer is armed: it may fire on another CPU at once
+    self->state = THREAD_BLOCKED;
+    timer_setup(&self->sleep_timer, sleep_timer_fn, self);
+    timer_arm(&self->sleep_timer, ms_to_ticks(ms));
+    schedule();
+    irq_restore(flags);
+}
+
+/*
+ * Turn the calling kernel thread into a user thread: adopt as, then iret to
+ * ring 3 at eip on user_esp. The kernel stack is reset, so this never
+ * returns; the thread ends through the SYS_EXIT system call.
+ */
+void thread_enter_user(struct address_space *as, uint32_t eip, uint32_t user_esp) {
+    irq_save();
+    current->as = as;
+    as_switch(as);
+    enter_user_mode(eip, user_esp, (uint32_t)(current->stack + THREAD_STACK_SIZE));
+}
+
+void thread_exit(void) {
+    irq_save();
+    current->state = THREAD_DEAD;
+    schedule();
+    halt_forever();   // not reached
+}
@@ -0,0 +1,75 @@
+#ifndef THREAD_H
+#define THREAD_H
+
+#include <stdint.h>
+#include "timer.h"
+#include "vm.h"
+#include "smp.h"
+#include "fpu.h"
+
+#define MAX_THREADS        32
+#define THREAD_STACK_SIZE  16384
+#define NUM_PRIORITIES     32
+#define THREAD_PRIO_HIGH   0
+#define THREAD_PRIO_DEFAULT 16
+#define THREAD_PRIO_IDLE   (NUM_PRIORITIES - 1)
+#define THREAD_SLICE_TICKS 10
+
+enum thread_state {
+    THREAD_UNUSED = 0,
+    THREAD_READY,
+    THREAD_RUNNING,
+    THREAD_BLOCKED,
+    THREAD_DEAD,
+};
+
+struct spinlock;
+
+typedef void (*thread_fn)(void *arg);
+
+struct thread {
+    uint32_t esp;                // saved stack pointer while switched out
+    struct thread *next;         // run queue links
+    struct thread *prev;
+    volatile enum thread_state state;
+    int priority;                // 0 is the most urgent
+    int slice;                   // ticks left before preemption
+    int id;
+    const char *name;
+    thread_fn fn;
+    void *arg;
+    uint8_t *stack;
+    struct address_space *as;    // 0 = kernel address space
+    int cpu;                     // CPU it last ran on (or was queued for)
+    int pinned;                  // never migrated to another CPU
+    volatile int on_cpu;         // set until its CPU has switched away from it
+    struct timer sleep_timer;
+    struct thread *wait_next;    // link on a mutex wait list while blocked there
+    int fpu_used;                // has an FPU image (else starts from fninit)
+    int fpu_cpu;                 // CPU whose registers last held its state
+    struct fpu_state fpu;        // saved on switch-out if it used the FPU
+};
+
+// Thread running on the calling CPU
+#define current (this_cpu()->current_thread)
+
+void sched_init(void);
+void sched_tick(void);
+void sched_preempt(void);
+void schedule(void);
+struct thread *thread_create(const char *name, thread_fn fn, void *arg, int priority);
+struct thread *thread_create_pinned(const char *name, thread_fn fn, void *arg, int priority);
+void sched_start_ap(void);
+void thread_yield(void);
+void thread_block(void);
+void thread_block_unlock(struct spinlock *lock, uint32_t flags);
+void thread_wake(struct thread *t);
+void sched_kick_cpu(int id);
+void thread_sleep_ms(uint32_t ms);
+void thread_exit(void);
+void thread_enter_user(struct address_space *as, uint32_t eip, uint32_t user_esp);
+
+// Implemented in switch.s
+void switch_context(uint32_t *save_esp, uint32_t load_esp);
+
+#endif
@@ -0,0 +1,383 @@
+#include <stdint.h>
+#include "timer.h"
+#include "timing.h"
+#include "interrupt.h"
+#include "spinlock.h"
+#include "softirq.h"
+#include "apic.h"
+#include "smp.h"
+#include "thread.h"
+#include "atomic.h"
+
+#define PIT_CHANNEL0 0x40
+#define PIT_CHANNEL2 0x42
+#define PIT_COMMAND  0x43
+#define PIT_GATE     0x61   // bit 0 gates channel 2, bit 5 reads its output
+
+#define CALIBRATE_MS 10
+#define NS_SHIFT     22
+
+// Wheel geometry: 256 one-tick slots, then three levels of 64 coarser slots.
+// Covers 2^26 ticks (about 18 hours at 1 kHz); longer timeouts are clamped.
+#define TVR_BITS 8
+#define TVN_BITS 6
+#define TVR_SIZE (1 << TVR_BITS)
+#define TVN_SIZE (1 << TVN_BITS)
+#define TVR_MASK (TVR_SIZE - 1)
+#define TVN_MASK (TVN_SIZE - 1)
+#define MAX_TIMEOUT ((1 << (TVR_BITS + 3 * TVN_BITS)) - 1)
+
+volatile uint32_t ticks = 0;
+uint32_t tsc_khz = 0;
+
+static uint32_t timer_hz;
+static uint32_t ns_per_tick;
+static uint32_t ns_mult;            // ns = (cycles * ns_mult) >> NS_SHIFT
+static uint32_t cycles_per_tick;    // TSC cycles in one tick, 0 if uncalibrated
+
+// Written by the tick handler, read by timer_now_ns() under tick_seq
+static volatile uint32_t tick_seq = 0;
+static volatile uint64_t tick_tsc = 0;
+
+// Guards the wheel: timers are armed from any CPU, run on the BSP's tick
+static struct spinlock timer_lock;
+static uint32_t wheel_ticks;        // next tick the wheel has to process
+static uint32_t nr_timers;          // armed timers, so an empty wheel is cheap to spot
+static struct timer tv1[TVR_SIZE];
+static struct timer tv2[TVN_SIZE];
+static struct timer tv3[TVN_SIZE];
+static struct timer tv4[TVN_SIZE];
+
+static void list_init(struct timer *head) {
+    head->next = head;
+    head->prev = head;
+}
+
+static void list_add_tail(struct timer *head, struct timer *t) {
+    t->prev = head->prev;
+    t->next = head;
+    head->prev->next = t;
+    head->prev = t;
+}
+
+static void list_del(struct timer *t) {
+    t->prev->next = t->next;
+    t->next->prev = t->prev;
+    t->next = 0;
+    t->prev = 0;
+}
+
+static void internal_add_timer(struct timer *t) {
+    uint32_t expires = t->expires;
+    uint32_t idx = expires - wheel_ticks;
+    struct timer *head;
+
+    if ((int32_t)idx < 0) {
+        // Already due: run on the next tick processed
+        head = &tv1[wheel_ticks & TVR_MASK];
+    } else if (idx < TVR_SIZE) {
+        head = &tv1[expires & TVR_MASK];
+    } else if (idx < 1 << (TVR_BITS + TVN_BITS)) {
+        head = &tv2[(expires >> TVR_BITS) & TVN_MASK];
+    } else if (idx < 1 << (TVR_BITS + 2 * TVN_BITS)) {
+        head = &tv3[(expires >> (TVR_BITS + TVN_BITS)) & TVN_MASK];
+    } else {
+        if (idx > MAX_TIMEOUT) {
+            expires = wheel_ticks + MAX_TIMEOUT;
+            t->expires = expires;
+        }
+        head = &tv4[(expires >> (TVR_BITS + 2 * TVN_BITS)) & TVN_MASK];
+    }
+    list_add_tail(head, t);
+}
+
+// Re-file every timer in one coarse slot into the finer levels below it.
+// Returns the slot index so the caller knows whether to cascade further up.
+static uint32_t cascade(struct timer *level, uint32_t index) {
+    struct timer *head = &level[index];
+    struct timer *t = head->next;
+
+    list_init(head);
+    while (t != head) {
+        struct timer *next = t->next;
+        internal_add_timer(t);
+        t = next;
+    }
+    return index;
+}
+
+// Process every wheel slot up to the current tick. Runs as deferred work
+// after the tick IRQ, with interrupts enabled; callbacks run without
+// timer_lock so they may re-arm timers.
+static void run_timers(struct work *w, void *arg) {
+    uint32_t flags = spin_lock_irqsave(&timer_lock);
+
+    while ((int32_t)(ticks - wheel_ticks) >= 0) {
+        uint32_t index = wheel_ticks & TVR_MASK;
+
+        if (index == 0 &&
+            cascade(tv2, (wheel_ticks >> TVR_BITS) & TVN_MASK) == 0 &&
+            cascade(tv3, (wheel_ticks >> (TVR_BITS + TVN_BITS)) & TVN_MASK) == 0) {
+            cascade(tv4, (wheel_ticks >> (TVR_BITS + 2 * TVN_BITS)) & TVN_MASK);
+        }
+        wheel_ticks++;
+
+        struct timer *head = &tv1[index];
+        while (head->next != head) {
+            struct timer *t = head->next;
+            list_del(t);
+            nr_timers--;
+            spin_unlock_irqrestore(&timer_lock, flags);
+            t->fn(t, t->arg);
+            flags = spin_lock_irqsave(&timer_lock);
+        }
+    }
+    spin_unlock_irqrestore(&timer_lock, flags);
+}
+
+static struct work timer_work = { .fn = run_timers };
+
+// Count TSC cycles across a CALIBRATE_MS one-shot on PIT channel 2.
+// Needs no interrupts, so it works before sti.
+static uint32_t calibrate_tsc_khz(void) {
+    uint32_t latch = PIT_BASE_HZ / (1000 / CALIBRATE_MS);
+    uint32_t spins = 0;
+
+    outb(PIT_GATE, (inb(PIT_GATE) & ~0x02) | 0x01);   // gate on, speaker off
+    outb(PIT_COMMAND, 0xB0);                          // ch 2, lo/hi, mode 0
+    outb(PIT_CHANNEL2, latch & 0xFF);
+    outb(PIT_CHANNEL2, latch >> 8);
+
+    uint64_t t0 = rdtsc();
+    while ((inb(PIT_GATE) & 0x20) == 0) {
+        spins++;
+    }
+    uint64_t t1 = rdtsc();
+
+    // A channel that never counted down means there is no usable reference
+    if (spins < 16)
+        return 0;
+    return (uint32_t)(t1 - t0) / CALIBRATE_MS;
+}
+
+/*
+ * Program PIT channel 0 as a rate generator at hz, calibrate the TSC
+ * against it and unmask IRQ0. Interrupts still have to be enabled.
+ * apic_init() may later replace IRQ0 with the LAPIC timer at the same rate.
+ */
+void timer_init(uint32_t hz) {
+    uint32_t divisor = PIT_BASE_HZ / hz;
+
+    timer_hz = hz;
+    ns_per_tick = 1000000000 / hz;
+
+    tsc_khz = calibrate_tsc_khz();
+    if (tsc_khz) {
+        ns_mult = div64_32((uint64_t)1000000 << NS_SHIFT, tsc_khz);
+        cycles_per_tick = tsc_khz * 1000 / hz;
+    }
+
+    for (int i = 0; i < TVR_SIZE; i++)
+        list_init(&tv1[i]);
+    for (int i = 0; i < TVN_SIZE; i++) {
+        list_init(&tv2[i]);
+        list_init(&tv3[i]);
+        list_init(&tv4[i]);
+    }
+    wheel_ticks = ticks;
+
+    outb(PIT_COMMAND, 0x34);                          // ch 0, lo/hi, mode 2
+    outb(PIT_CHANNEL0, divisor & 0xFF);
+    outb(PIT_CHANNEL0, divisor >> 8);
+
+    tick_tsc = rdtsc();
+    irq_unmask(0);
+}
+
+// IRQ0 work: advance the clock; due timers fire from deferred work.
+void timer_tick(void) {
+    tick_seq++;
+    ticks++;
+    tick_tsc = rdtsc();
+    tick_seq++;
+
+    work_queue(&timer_work);
+}
+
+/*
+ * Monotonic nanoseconds since timer_init(): whole ticks plus the TSC time
+ * elapsed since the last one, clamped so it never runs past the next tick.
+ */
+uint64_t timer_now_ns(void) {
+    uint32_t seq, t;
+    uint64_t last;
+
+    do {
+        seq = tick_seq;
+        t = ticks;
+        last = tick_tsc;
+    } while ((seq & 1) || seq != tick_seq);
+
+    uint64_t ns = (uint64_t)t * ns_per_tick;
+    if (tsc_khz) {
+        uint32_t delta = (uint32_t)(rdtsc() - last);
+        uint64_t extra = ((uint64_t)delta * ns_mult) >> NS_SHIFT;
+        ns += (extra < ns_per_tick) ? extra : ns_per_tick - 1;
+    }
+    return ns;
+}
+
+uint32_t ms_to_ticks(uint32_t ms) {
+    uint64_t n = (uint64_t)ms * timer_hz + 999;
+
+    // div64_32() faults if the quotient does not fit; saturate instead
+    if ((uint32_t)(n >> 32) >= 1000)
+        return 0xFFFFFFFF;
+    return div64_32(n, 1000);
+}
+
+void timer_setup(struct timer *t, timer_fn fn, void *arg) {
+    t->next = 0;
+    t->prev = 0;
+    t->expires = 0;
+    t->fn = fn;
+    t->arg = arg;
+}
+
+// Ticks the BSP would have counted by now; differs from ticks only while
+// its tick is stopped.
+static uint32_t ticks_now(void) {
+    uint32_t seq, t;
+    uint64_t last;
+
+    if (!cpus[0].nohz)
+        return ticks;
+    do {
+        seq = tick_seq;
+        t = ticks;
+        last = tick_tsc;
+    } while ((seq & 1) || seq != tick_seq);
+    return t + div64_32(rdtsc() - last, cycles_per_tick);
+}
+
+// (Re)arm t to fire delay_ticks from now. O(1).
+void timer_arm(struct timer *t, uint32_t delay_ticks) {
+    uint32_t flags = spin_lock_irqsave(&timer_lock);
+    if (t->next)
+        list_del(t);
+    else
+        nr_timers++;
+    t->expires = ticks_now() + delay_ticks;
+    internal_add_timer(t);
+    spin_unlock_irqrestore(&timer_lock, flags);
+
+    // A tickless BSP programmed its wake-up without this timer
+    if (cpus[0].nohz)
+        sched_kick_cpu(0);
+}
+
+// O(1): unlink t from whatever slot it is in. Safe on an idle timer.
+void timer_cancel(struct timer *t) {
+    uint32_t flags = spin_lock_irqsave(&timer_lock);
+    if (t->next) {
+        list_del(t);
+        nr_timers--;
+    }
+    spin_unlock_irqrestore(&timer_lock, flags);
+}
+
+int timer_pending(struct timer *t) {
+    return t->next != 0;
+}
+
+/*
+ * Ticks from now until the earliest armed timer can be due: 0 while the
+ * wheel still has ticks to process, TIMER_NO_EVENT if nothing is armed.
+ * Only tv1 is scanned; a timer on a coarser level is at least as far out
+ * as the next cascade, so that is a safe (early) answer for those.
+ */
+uint32_t timer_next_event(void) {
+    uint32_t flags = spin_lock_irqsave(&timer_lock);
+    uint32_t delta;
+
+    if ((int32_t)(ticks - wheel_ticks) >= 0) {
+        delta = 0;
+    } else if (nr_timers == 0) {
+        delta = TIMER_NO_EVENT;
+    } else {
+        uint32_t k = 0;
+        do {
+            if (tv1[(wheel_ticks + k) & TVR_MASK].next != &tv1[(wheel_ticks + k) & TVR_MASK])
+                break;
+            k++;
+        } while ((wheel_ticks + k) & TVR_MASK);
+        delta = wheel_ticks + k - ticks;
+    }
+    spin_unlock_irqrestore(&timer_lock, flags);
+    return delta;
+}
+
+/*
+ * Tickless idle. Called by the idle loop with interrupts disabled, right
+ * before hlt. An AP simply stops its LAPIC timer: it has no timekeeping
+ * duty and is woken by a reschedule IPI. The BSP owns ticks and the wheel,
+ * so it only stops ticking once every other CPU is idle too (nothing can
+ * arm a timer behind its back then; timer_arm() kicks it if one does), and
+ * programs a one-shot for the next timer instead. Without a LAPIC, or an
+ * event less than two ticks out, the tick keeps running.
+ */
+void timer_nohz_enter(void) {
+    struct cpu *c = this_cpu();
+
+    if (!apic_enabled)
+        return;
+    if (c->id != 0) {
+        c->nohz = 1;
+        lapic_timer_oneshot(0);
+        return;
+    }
+
+    if (!cycles_per_tick)
+        return;
+    for (uint32_t i = 1; i < cpus_online; i++) {
+        if (!cpus[i].idle)
+            return;
+    }
+    // Publish nohz before reading the wheel: a timer_arm() racing with us
+    // either lands in the scan below or sees nohz and kicks us awake.
+    c->nohz = 1;
+    smp_mb();
+    uint32_t delta = timer_next_event();
+    if (delta <= 1) {
+        c->nohz = 0;
+        return;
+    }
+    // One tick early at worst: the restarted periodic tick covers the rest
+    lapic_timer_oneshot(delta == TIMER_NO_EVENT ? 0 : delta - 1);
+}
+
+/*
+ * First thing any interrupt does on a tickless CPU: restart the periodic
+ * tick. The BSP also accounts for the ticks it slept through, so ticks and
+ * timer_now_ns() stay monotonic, and queues the wheel to catch up. If the
+ * interrupt is the one-shot itself, the timer handler counts one more.
+ */
+void timer_nohz_exit(int tick_irq) {
+    struct cpu *c = this_cpu();
+
+    c->nohz = 0;
+    if (c->id == 0) {
+        uint32_t missed = div64_32(rdtsc() - tick_tsc, cycles_per_tick);
+
+        if (tick_irq && missed)
+            missed--;
+        if (missed) {
+            tick_seq++;
+            ticks += missed;
+            tick_tsc += (uint64_t)missed * cycles_per_tick;
+            tick_seq++;
+            work_queue(&timer_work);
+        }
+    }
+    lapic_timer_start();
+}
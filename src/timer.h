@@ -0,0 +1,44 @@
+#ifndef TIMER_H
+#define TIMER_H
+
+#include <stdint.h>
+
+#ifndef CONFIG_TIMER_HZ
+#define CONFIG_TIMER_HZ 1000
+#endif
+
+#define PIT_BASE_HZ 1193182
+#define TIMER_NO_EVENT 0xFFFFFFFF   // timer_next_event(): wheel is empty
+
+struct timer;
+typedef void (*timer_fn)(struct timer *t, void *arg);
+
+/*
+ * One timeout on the timer wheel. Embed it in whatever needs the callback;
+ * arming and cancelling only relink it, so both are O(1).
+ */
+struct timer {
+    struct timer *next;
+    struct timer *prev;
+    uint32_t expires;   // absolute tick
+    timer_fn fn;
+    void *arg;
+};
+
+extern volatile uint32_t ticks;
+extern uint32_t tsc_khz;
+
+void timer_init(uint32_t hz);
+void timer_tick(void);
+uint64_t timer_now_ns(void);
+uint32_t ms_to_ticks(uint32_t ms);
+
+void timer_setup(struct timer *t, timer_fn fn, void *arg);
+void timer_arm(struct timer *t, uint32_t delay_ticks);
+void timer_cancel(struct timer *t);
+int timer_pending(struct timer *t);
+uint32_t timer_next_event(void);
+void timer_nohz_enter(void);
+void timer_nohz_exit(int tick_irq);
+
+#endif
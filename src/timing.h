@@ -0,0 +1,22 @@
+#ifndef TIMING_H
+#define TIMING_H
+
+#include <stdint.h>
+
+// Read the CPU time-stamp counter (cycles since reset).
+static inline uint64_t rdtsc(void) {
+    uint64_t ret;
+    __asm__ __volatile__("rdtsc" : "=A"(ret));
+    return ret;
+}
+
+// 64-by-32 division without libgcc. The quotient must fit in 32 bits.
+static inline uint32_t div64_32(uint64_t n, uint32_t d) {
+    uint32_t q, r;
+    __asm__("divl %4"
+            : "=a"(q), "=d"(r)
+            : "a"((uint32_t)n), "d"((uint32_t)(n >> 32)), "rm"(d));
+    return q;
+}
+
+#endif
@@ -0,0 +1,112 @@
+#include <stdint.h>
+#include "trace.h"
+
+#ifdef CONFIG_TRACE
+#include "smp.h"
+#include "timer.h"
+#include "timing.h"
+#include "interrupt.h"
+#include "serial.h"
+#include "thread.h"
+#include "rprintf.h"
+
+// Events kept per CPU; a power of two so the ring index is a mask
+#define TRACE_ORDER  12
+#define TRACE_EVENTS (1 << TRACE_ORDER)
+#define TRACE_MASK   (TRACE_EVENTS - 1)
+
+// 56 bits of TSC last for years
+struct trace_event {
+    uint64_t tsc : 56;
+    uint64_t phase : 2;              // TRACE_BEGIN, TRACE_END or TRACE_INSTANT
+    uint64_t handler : 1;            // recorded with TRACE_HANDLER
+    uint64_t thread : 5;             // current->id when recorded
+    const char *name;
+    uint32_t arg;
+};
+
+_Static_assert(sizeof(struct trace_event) == 16, "trace events are 16 bytes");
+_Static_assert(MAX_THREADS <= 32, "thread ids must fit trace_event.thread");
+
+// Only its own CPU writes a ring, with interrupts off, so no locking
+struct trace_cpu {
+    uint32_t count;                  // events ever recorded; ring index mod TRACE_EVENTS
+    struct trace_event ring[TRACE_EVENTS];
+} __attribute__((aligned(64)));
+
+static struct trace_cpu trace_cpus[MAX_CPUS];
+volatile int trace_enabled = 0;
+
+void trace_record(const char *name, uint32_t arg, int phase) {
+    uint32_t flags = irq_save();
+    struct cpu *c = this_cpu();
+    struct trace_cpu *t = &trace_cpus[c->id];
+    struct trace_event *e = &t->ring[t->count++ & TRACE_MASK];
+
+    e->tsc = rdtsc();
+    e->name = name;
+    e->arg = arg;
+    e->phase = phase & 3;
+    e->handler = !!(phase & TRACE_HANDLER);
+    e->thread = c->current_thread ? c->current_thread->id : 0;
+    irq_restore(flags);
+}
+
+// Empty every ring and start recording.
+void trace_start(void) {
+    trace_enabled = 0;
+    for (int c = 0; c < MAX_CPUS; c++) {
+        trace_cpus[c].count = 0;
+    }
+    __atomic_store_n(&trace_enabled, 1, __ATOMIC_RELEASE);
+}
+
+void trace_stop(void) {
+    trace_enabled = 0;
+}
+
+#define sout(...) esp_wprintf(serial_write, __VA_ARGS__)
+
+/*
+ * Stream every CPU's ring over COM1, oldest event first, as text lines
+ * that tools/trace2json.py converts (TSC in hex; the thread is "-" for
+ * handler events):
+ *   TRACE BEGIN <tsc_khz> <cpus>
+ *   TRACE <cpu> <thread> <tsc> <B|E|i> <name> <arg>
+ *   TRACE END
+ * Stop tracing first.
+ */
+void trace_dump(void) {
+    static const char phases[] = "BEi";
+
+    sout("TRACE BEGIN %d %d\n", tsc_khz, cpus_online);
+    for (uint32_t c = 0; c < cpus_online; c++) {
+        struct trace_cpu *t = &trace_cpus[c];
+        uint32_t first = t->count > TRACE_EVENTS ? t->count - TRACE_EVENTS : 0;
+
+        for (uint32_t i = first; i != t->count; i++) {
+            struct trace_event *e = &t->ring[i & TRACE_MASK];
+            uint64_t tsc = e->tsc;
+            if (e->handler)
+                sout("TRACE %d - ", c);
+            else
+                sout("TRACE %d %d ", c, e->thread);
+            sout("%x%08x %c %s %x\n", (uint32_t)(tsc >> 32), (uint32_t)tsc,
+                 phases[e->phase], e->name, e->arg);
+        }
+    }
+    sout("TRACE END\n");
+}
+
+// Monitor command: start tracing, or stop and dump to serial.
+void trace_toggle(void) {
+    if (trace_enabled) {
+        trace_stop();
+        printk("Tracing stopped, dumping to serial\n");
+        trace_dump();
+    } else {
+        printk("Tracing started\n");
+        trace_start();
+    }
+}
+#endif
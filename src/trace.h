@@ -0,0 +1,71 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+
+/*
+ * Event tracing: begin/end pairs and instant events stamped with the TSC
+ * and the current thread, kept in a per-CPU ring that overwrites its
+ * oldest entries. trace_dump() streams the rings over COM1 for
+ * tools/trace2json.py, which turns them into Chrome/Perfetto trace JSON.
+ * Built with CONFIG_TRACE; without it the trace points compile to nothing.
+ * Names must be string literals, since only the pointer is recorded.
+ */
+#define TRACE_BEGIN   0
+#define TRACE_END     1
+#define TRACE_INSTANT 2
+#define TRACE_HANDLER 4   // or'ed in: belongs to its CPU, not the interrupted thread
+
+#ifdef CONFIG_TRACE
+extern volatile int trace_enabled;
+
+void trace_record(const char *name, uint32_t arg, int phase);
+
+static inline void trace_begin(const char *name, uint32_t arg) {
+    if (trace_enabled)
+        trace_record(name, arg, TRACE_BEGIN);
+}
+
+static inline void trace_end(const char *name, uint32_t arg) {
+    if (trace_enabled)
+        trace_record(name, arg, TRACE_END);
+}
+
+static inline void trace_instant(const char *name, uint32_t arg) {
+    if (trace_enabled)
+        trace_record(name, arg, TRACE_INSTANT);
+}
+
+// Interrupt and exception handlers: drawn on the CPU's own track
+static inline void trace_handler_begin(const char *name, uint32_t arg) {
+    if (trace_enabled)
+        trace_record(name, arg, TRACE_BEGIN | TRACE_HANDLER);
+}
+
+static inline void trace_handler_end(const char *name, uint32_t arg) {
+    if (trace_enabled)
+        trace_record(name, arg, TRACE_END | TRACE_HANDLER);
+}
+
+void trace_start(void);
+void trace_stop(void);
+void trace_dump(void);
+void trace_toggle(void);
+#else
+static inline void trace_begin(const char *name, uint32_t arg) {
+}
+
+static inline void trace_end(const char *name, uint32_t arg) {
+}
+
+static inline void trace_instant(const char *name, uint32_t arg) {
+}
+
+static inline void trace_handler_begin(const char *name, uint32_t arg) {
+}
+
+static inline void trace_handler_end(const char *name, uint32_t arg) {
+}
+#endif
+
+#endif
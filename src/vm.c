@@ -0,0 +1,228 @@
+#include <stdint.h>
+#include "vm.h"
+#include "interrupt.h"
+#include "thread.h"
+#include "lib/string.h"
+
+#define PAGE_SIZE PAGE_FRAME_SIZE
+#define KERNEL_PDES (KERNEL_SPACE_END >> 22)
+
+extern struct page_directory_entry pd[1024];
+
+struct address_space kernel_address_space;
+static struct address_space address_spaces[MAX_ADDRESS_SPACES];
+
+static void copy_frame(void *dst, const void *src) {
+    memcpy(dst, src, PAGE_SIZE);
+}
+
+void vm_init(void) {
+    kernel_address_space.pd = pd;
+    kernel_address_space.pd_frame = 0;
+    kernel_address_space.in_use = 1;
+}
+
+/*
+ * New address space with an empty user half. The kernel half is copied from
+ * pd at this point, so kernel page tables must exist before processes are
+ * created (kernel mappings made later only show up in pd itself).
+ */
+struct address_space *as_create(void) {
+    struct address_space *as = 0;
+    for (int i = 0; i < MAX_ADDRESS_SPACES; i++) {
+        if (!address_spaces[i].in_use) {
+            as = &address_spaces[i];
+            break;
+        }
+    }
+    if (!as)
+        return 0;
+
+    struct ppage *frame = alloc_zeroed_page();
+    if (!frame)
+        return 0;
+
+    as->pd_frame = frame;
+    as->pd = frame->physical_addr;
+    as->in_use = 1;
+    for (int i = 0; i < KERNEL_PDES; i++) {
+        as->pd[i] = pd[i];
+    }
+    map_recursive(as->pd);
+    return as;
+}
+
+// Drop every user mapping (and the frames nobody else shares), then the
+// page tables and the directory itself.
+void as_destroy(struct address_space *as) {
+    if (!as || as == &kernel_address_space || !as->in_use)
+        return;
+
+    if (current_page_directory() == as->pd)
+        as_switch(&kernel_address_space);
+
+    for (int dir = KERNEL_PDES; dir < RECURSIVE_PDE; dir++) {
+        if (!as->pd[dir].present)
+            continue;
+        struct page *pt = (struct page *)(as->pd[dir].frame << 12);
+        for (int i = 0; i < 1024; i++) {
+            if (pt[i].present)
+                put_physical_page(ppage_from_addr((void *)(pt[i].frame << 12)));
+        }
+        put_physical_page(ppage_from_addr(pt));
+    }
+
+    put_physical_page(as->pd_frame);
+    as->in_use = 0;
+}
+
+/*
+ * Copy-on-write fork: the child gets its own page tables, but every user
+ * frame is shared. Writable pages become read-only in both parent and child
+ * and are tagged cow; the first write from either side faults and
+ * vm_handle_page_fault() gives the writer a private copy.
+ */
+struct address_space *as_fork(struct address_space *parent) {
+    struct address_space *child = as_create();
+    if (!child)
+        return 0;
+
+    for (int dir = KERNEL_PDES; dir < RECURSIVE_PDE; dir++) {
+        if (!parent->pd[dir].present)
+            continue;
+
+        struct ppage *table_frame = alloc_page();   // every entry is copied below
+        if (!table_frame) {
+            as_destroy(child);
+            return 0;
+        }
+        struct page *parent_pt = (struct page *)(parent->pd[dir].frame << 12);
+        struct page *child_pt = table_frame->physical_addr;
+
+        for (int i = 0; i < 1024; i++) {
+            if (parent_pt[i].present) {
+                if (parent_pt[i].rw) {
+                    parent_pt[i].rw = 0;
+                    parent_pt[i].cow = 1;
+                }
+                get_physical_page(ppage_from_addr((void *)(parent_pt[i].frame << 12)));
+            }
+            child_pt[i] = parent_pt[i];
+        }
+
+        child->pd[dir] = parent->pd[dir];
+        child->pd[dir].frame = ((uint32_t)child_pt) >> 12;
+    }
+
+    // The parent's writable user entries just became read-only
+    if (current_page_directory() == parent->pd)
+        flush_tlb();
+    return child;
+}
+
+// The address space belongs to the calling thread, so the scheduler restores
+// it wherever the thread runs next.
+void as_switch(struct address_space *as) {
+    if (current)
+        current->as = (as == &kernel_address_space) ? 0 : as;
+    loadPageDirectory(as->pd);
+}
+
+// Back vaddr in the user half with a fresh zeroed frame.
+int as_map_user_page(struct address_space *as, void *vaddr, int writable) {
+    if (is_kernel_address(vaddr))
+        return -1;
+
+    struct page *pte = lookup_pte(as->pd, vaddr, 1);
+    if (!pte)
+        return -1;
+    if (pte->present)
+        put_physical_page(ppage_from_addr((void *)(pte->frame << 12)));
+
+    struct ppage *frame = alloc_zeroed_page();
+    if (!frame)
+        return -1;
+
+    pte->present = 1;
+    pte->demand = 0;
+    pte->rw = writable;
+    pte->user = 1;
+    pte->cow = 0;
+    pte->global = 0;
+    pte->frame = ((uint32_t)frame->physical_addr) >> 12;
+
+    if (current_page_directory() == as->pd)
+        invlpg(vaddr);
+    return 0;
+}
+
+/*
+ * Reserve vaddr in the user half without backing it yet: the first access
+ * faults and vm_handle_page_fault() maps a zeroed frame there.
+ */
+int as_reserve_user_page(struct address_space *as, void *vaddr, int writable) {
+    if (is_kernel_address(vaddr))
+        return -1;
+
+    struct page *pte = lookup_pte(as->pd, vaddr, 1);
+    if (!pte)
+        return -1;
+    if (pte->present)
+        put_physical_page(ppage_from_addr((void *)(pte->frame << 12)));
+
+    *(uint32_t *)pte = 0;
+    pte->rw = writable;
+    pte->user = 1;
+    pte->demand = 1;
+
+    if (current_page_directory() == as->pd)
+        invlpg(vaddr);
+    return 0;
+}
+
+// First touch of a reserved page: back it with a frame from the zeroed pool.
+static int handle_demand_zero(struct page *pte) {
+    struct ppage *frame = alloc_zeroed_page();
+    if (!frame)
+        return -1;
+
+    pte->frame = ((uint32_t)frame->physical_addr) >> 12;
+    pte->demand = 0;
+    pte->present = 1;
+    return 0;
+}
+
+/*
+ * Resolve a fault on a demand-zero page, or a write fault on a
+ * copy-on-write page, in the current address space. Returns 0 if the
+ * fault was handled, -1 if it is a real fault.
+ */
+int vm_handle_page_fault(uint32_t fault_addr, uint32_t error_code) {
+    void *page_addr = (void *)(fault_addr & ~(PAGE_SIZE - 1));
+    struct page *pte = get_pte(page_addr);
+
+    if (!(error_code & PF_PRESENT)) {
+        if (!pte || pte->present || !pte->demand)
+            return -1;
+        return handle_demand_zero(pte);
+    }
+    if (!(error_code & PF_WRITE))
+        return -1;
+    if (!pte || !pte->present || !pte->cow)
+        return -1;
+
+    struct ppage *old = ppage_from_addr((void *)(pte->frame << 12));
+    if (old && old->refcount > 1) {
+        struct ppage *copy = alloc_page();
+        if (!copy)
+            return -1;
+        copy_frame(copy->physical_addr, (void *)(pte->frame << 12));
+        pte->frame = ((uint32_t)copy->physical_addr) >> 12;
+        put_physical_page(old);
+    }
+    // Last sharer (or just copied): the page is private and writable again
+    pte->rw = 1;
+    pte->cow = 0;
+    invlpg(page_addr);
+    return 0;
+}
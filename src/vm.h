@@ -0,0 +1,31 @@
+#ifndef VM_H
+#define VM_H
+
+#include <stdint.h>
+#include "paging.h"
+
+#define MAX_ADDRESS_SPACES 16
+
+/*
+ * A process address space: its own page directory whose kernel half
+ * (below KERNEL_SPACE_END) points at the same page tables as the kernel's
+ * pd, and whose user half is private (or shared copy-on-write after fork).
+ */
+struct address_space {
+    struct page_directory_entry *pd;
+    struct ppage *pd_frame;
+    int in_use;
+};
+
+extern struct address_space kernel_address_space;
+
+void vm_init(void);
+struct address_space *as_create(void);
+void as_destroy(struct address_space *as);
+struct address_space *as_fork(struct address_space *parent);
+void as_switch(struct address_space *as);
+int as_map_user_page(struct address_space *as, void *vaddr, int writable);
+int as_reserve_user_page(struct address_space *as, void *vaddr, int writable);
+int vm_handle_page_fault(uint32_t fault_addr, uint32_t error_code);
+
+#endif
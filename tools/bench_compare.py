@@ -0,0 +1,106 @@
+#!/usr/bin/env python3
+"""Compare a benchmark run (src/bench.c) against a stored baseline.
+
+Usage:
+    make bench                                     # runs this at the end
+    tools/bench_compare.py bench.log tools/bench_baseline.txt
+    tools/bench_compare.py bench.log tools/bench_baseline.txt --update
+
+The log is the kernel's serial output; only `BENCH <name> <cycles>` lines
+count, and the run must end with `BENCH_END <status>`. The baseline uses
+the same `BENCH` line format, so a saved log works as one. Results are
+cycles, so lower is better; anything slower than the baseline by more than
+--threshold (a fraction) is flagged. If the baseline does not exist yet,
+this run becomes it.
+
+Exit status: 0 if nothing regressed, 1 on regressions, 2 if the run did
+not complete or either file has a malformed BENCH line.
+"""
+import argparse
+import os
+import sys
+
+
+class BadLine(Exception):
+    pass
+
+
+def load(path):
+    results = {}
+    complete = False
+    with open(path, errors="replace") as f:
+        for lineno, line in enumerate(f, 1):
+            fields = line.split()
+            if fields and fields[0] == "BENCH":
+                if len(fields) != 3 or not fields[2].isdigit():
+                    raise BadLine("%s:%d: malformed result: %s"
+                                  % (path, lineno, line.strip()))
+                results[fields[1]] = int(fields[2])
+            elif fields and fields[0] == "BENCH_END":
+                complete = True
+    return results, complete
+
+
+def save(path, results):
+    with open(path, "w") as f:
+        for name, cycles in results.items():
+            f.write("BENCH %s %d\n" % (name, cycles))
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    ap.add_argument("log", help="serial log of the benchmark run")
+    ap.add_argument("baseline", help="baseline results, created if missing")
+    ap.add_argument("--threshold", type=float, default=0.10,
+                    help="allowed slowdown as a fraction (default 0.10)")
+    ap.add_argument("--update", action="store_true",
+                    help="replace the baseline with this run")
+    args = ap.parse_args()
+
+    try:
+        results, complete = load(args.log)
+    except BadLine as e:
+        print(e, file=sys.stderr)
+        return 2
+    if not results or not complete:
+        print("%s: benchmark run did not complete (%d results, no BENCH_END)"
+              % (args.log, len(results)), file=sys.stderr)
+        return 2
+
+    if args.update or not os.path.exists(args.baseline):
+        save(args.baseline, results)
+        print("baseline %s: %d results saved" % (args.baseline, len(results)))
+        return 0
+
+    try:
+        baseline, _ = load(args.baseline)
+    except BadLine as e:
+        print(e, file=sys.stderr)
+        return 2
+    regressions = 0
+    print("%-32s %14s %14s %8s" % ("benchmark", "baseline", "now", "change"))
+    for name, cycles in results.items():
+        base = baseline.get(name)
+        if base is None:
+            print("%-32s %14s %14d %8s  new" % (name, "-", cycles, ""))
+            continue
+        change = (cycles - base) / base if base else 0.0
+        flag = ""
+        if change > args.threshold:
+            flag = "  REGRESSION"
+            regressions += 1
+        elif change < -args.threshold:
+            flag = "  faster"
+        print("%-32s %14d %14d %+7.1f%%%s" % (name, base, cycles, 100 * change, flag))
+    for name in baseline:
+        if name not in results:
+            print("%-32s %14d %14s %8s  missing" % (name, baseline[name], "-", ""))
+
+    if regressions:
+        print("%d regression(s) beyond %.0f%%" % (regressions, 100 * args.threshold))
+        return 1
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,51 @@
+#!/bin/sh
+# Measure how much host CPU an idle guest costs.
+#
+# Usage:
+#     make rootfs.img
+#     tools/idle_cpu.sh [smp] [settle_s] [sample_s]
+#
+# Boots rootfs.img headless in qemu (serial output goes to idle_cpu.log),
+# waits settle_s seconds for boot and the boot-time tests to finish, then
+# samples the qemu process's user+system time over sample_s seconds and
+# prints it as a percentage of one host CPU. Run it on a kernel built
+# before and after a change to compare; 100% per vCPU means the guest
+# spins instead of halting.
+
+SMP=${1:-4}
+SETTLE=${2:-10}
+SAMPLE=${3:-10}
+IMG=${IMG:-rootfs.img}
+LOG=${LOG:-idle_cpu.log}
+
+if [ ! -f "$IMG" ]; then
+    echo "$IMG not found; run make rootfs.img first" >&2
+    exit 1
+fi
+
+qemu-system-i386 -drive file="$IMG",format=raw,if=ide,index=0 -boot d \
+    -display none -serial file:"$LOG" -smp "$SMP" &
+QEMU=$!
+trap 'kill $QEMU 2>/dev/null' EXIT INT TERM
+
+# utime + stime of the qemu process, in clock ticks (fields 14 and 15; the
+# comm field has no spaces for qemu-system-i386)
+cpu_ticks() {
+    awk '{ print $14 + $15 }' /proc/$QEMU/stat
+}
+
+sleep "$SETTLE"
+if ! kill -0 $QEMU 2>/dev/null; then
+    echo "qemu exited during boot, see $LOG" >&2
+    exit 1
+fi
+
+HZ=$(getconf CLK_TCK)
+T0=$(cpu_ticks)
+sleep "$SAMPLE"
+T1=$(cpu_ticks)
+
+awk -v t0="$T0" -v t1="$T1" -v hz="$HZ" -v s="$SAMPLE" -v smp="$SMP" 'BEGIN {
+    pct = 100 * (t1 - t0) / hz / s
+    printf "idle guest (%d vCPUs): %.1f%% of one host CPU over %ds\n", smp, pct, s
+}'
@@ -0,0 +1,120 @@
+#!/usr/bin/env python3
+"""Turn the profiler's serial dump (src/prof.c) into readable profiles.
+
+Usage:
+    make run PROFILE=1 > serial.log        # or press 'p' twice in the monitor
+    tools/prof.py serial.log kernel                    # flat profile
+    tools/prof.py serial.log kernel --folded out.folded
+    flamegraph.pl out.folded > flame.svg
+
+Addresses are symbolized with `nm` against the kernel ELF; --lines adds
+file:line for the hottest entries through `addr2line` (needs -g).
+"""
+import argparse
+import bisect
+import collections
+import subprocess
+import sys
+
+
+def load_symbols(elf):
+    out = subprocess.run(["nm", "-n", "--defined-only", elf],
+                         capture_output=True, text=True, check=True).stdout
+    addrs, names = [], []
+    for line in out.splitlines():
+        parts = line.split()
+        # linker markers like _start_text share an address with a function
+        if len(parts) == 3 and parts[1] in "tTwW" and not parts[2].startswith(("_start_", "_end_")):
+            addrs.append(int(parts[0], 16))
+            names.append(parts[2])
+    return addrs, names
+
+
+def symbolize(addrs, names, pc):
+    i = bisect.bisect_right(addrs, pc) - 1
+    return names[i] if i >= 0 else "0x%x" % pc
+
+
+def parse(path):
+    hist = collections.Counter()     # pc -> samples, all CPUs
+    stacks = collections.Counter()   # tuple of pcs, innermost first -> samples
+    user = other = 0
+    hz = cpus = None
+    inside = False
+    with open(path, errors="replace") as f:
+        for line in f:
+            fields = line.strip().split()
+            if len(fields) < 2 or fields[0] != "PROF":
+                continue
+            kind = fields[1]
+            if kind == "BEGIN":
+                hist.clear(); stacks.clear(); user = other = 0
+                hz, cpus = int(fields[2]), int(fields[3])
+                inside = True
+            elif not inside:
+                continue
+            elif kind == "H":
+                hist[int(fields[3], 16)] += int(fields[4])
+            elif kind == "U":
+                user += int(fields[3])
+                other += int(fields[4])
+            elif kind == "S":
+                stacks[tuple(int(x, 16) for x in fields[3:])] += 1
+            elif kind == "END":
+                inside = False
+    if hz is None:
+        sys.exit("%s: no PROF BEGIN record found" % path)
+    return hz, cpus, hist, stacks, user, other
+
+
+def addr2line(elf, pcs):
+    if not pcs:
+        return {}
+    out = subprocess.run(["addr2line", "-e", elf] + ["0x%x" % pc for pc in pcs],
+                         capture_output=True, text=True).stdout.splitlines()
+    return dict(zip(pcs, out))
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__,
+                                 formatter_class=argparse.RawDescriptionHelpFormatter)
+    ap.add_argument("log", help="serial output containing a PROF dump")
+    ap.add_argument("elf", help="kernel ELF the dump came from")
+    ap.add_argument("--folded", metavar="FILE", help="write folded stacks for flamegraph.pl")
+    ap.add_argument("--top", type=int, default=30, help="functions in the flat profile")
+    ap.add_argument("--lines", action="store_true", help="also list the hottest source lines")
+    args = ap.parse_args()
+
+    addrs, names = load_symbols(args.elf)
+    hz, cpus, hist, stacks, user, other = parse(args.log)
+
+    funcs = collections.Counter()
+    for pc, n in hist.items():
+        funcs[symbolize(addrs, names, pc)] += n
+    total = sum(funcs.values()) + user + other
+    print("%d samples at %d Hz on %d CPU(s); %d in user mode, %d outside kernel text"
+          % (total, hz, cpus, user, other))
+    print("%8s %7s  %s" % ("samples", "percent", "function"))
+    for name, n in funcs.most_common(args.top):
+        print("%8d %6.2f%%  %s" % (n, 100.0 * n / max(total, 1), name))
+
+    if args.lines:
+        hot = [pc for pc, _ in hist.most_common(args.top)]
+        where = addr2line(args.elf, hot)
+        print("\n%8s  %-10s %s" % ("samples", "pc", "source"))
+        for pc in hot:
+            print("%8d  0x%08x %s" % (hist[pc], pc, where.get(pc, "?")))
+
+    if args.folded:
+        folded = collections.Counter()
+        for chain, n in stacks.items():
+            frames = [symbolize(addrs, names, pc) for pc in reversed(chain)]
+            folded[";".join(frames)] += n
+        with open(args.folded, "w") as f:
+            for key, n in sorted(folded.items()):
+                f.write("%s %d\n" % (key, n))
+        print("\nwrote %d folded stacks to %s" % (len(folded), args.folded))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,116 @@
+#!/usr/bin/env python3
+"""Turn the tracer's serial dump (src/trace.c) into Chrome trace JSON.
+
+Usage:
+    make run TRACE_BOOT=1 > serial.log     # or press 't' twice in the monitor
+    tools/trace2json.py serial.log trace.json
+
+Open trace.json in https://ui.perfetto.dev or chrome://tracing. Each
+kernel thread is one track, with the CPU an event ran on among its args,
+so a slice that blocks and resumes elsewhere stays in one piece.
+Interrupt and exception handler slices go on a track per CPU instead.
+Begin/end pairs become slices with their argument (LBA, fault address,
+vector, ...) attached. Timestamps are microseconds since the first event,
+converted with the TSC rate from the dump header. Events whose begin was
+overwritten in the ring are dropped; an end closes any slices opened
+inside it that never ended, and slices still open at the end of the dump
+are closed there.
+"""
+import argparse
+import json
+import sys
+
+CPU_TRACK_BASE = 1000
+
+
+def parse(lines):
+    tsc_khz = 0
+    events = []
+    for line in lines:
+        fields = line.split()
+        if len(fields) < 2 or fields[0] != "TRACE":
+            continue
+        if fields[1] == "BEGIN":
+            tsc_khz = int(fields[2])
+            events = []          # keep only the last dump in the log
+        elif fields[1] == "END":
+            continue
+        elif len(fields) == 7:
+            cpu, thread, tsc, phase, name, arg = fields[1:]
+            cpu = int(cpu)
+            # Threads keep their ids as tids; handler tracks go after them
+            tid = CPU_TRACK_BASE + cpu if thread == "-" else int(thread)
+            events.append((int(tsc, 16), tid, cpu, phase, name, int(arg, 16)))
+    return tsc_khz, events
+
+
+def convert(tsc_khz, events):
+    if not events:
+        return []
+    cycles_per_us = tsc_khz / 1000.0 if tsc_khz else 1.0
+    t0 = min(e[0] for e in events)
+    out = []
+    open_slices = {}             # tid -> stack of names
+
+    for tid in sorted({e[1] for e in events}):
+        if tid >= CPU_TRACK_BASE:
+            label = "cpu%d handlers" % (tid - CPU_TRACK_BASE)
+        else:
+            label = "thread %d" % tid
+        out.append({"name": "thread_name", "ph": "M", "pid": 0, "tid": tid,
+                    "args": {"name": label}})
+        open_slices[tid] = []
+
+    last_ts = 0.0
+    for tsc, tid, cpu, phase, name, arg in sorted(events):
+        ts = (tsc - t0) / cycles_per_us
+        last_ts = max(last_ts, ts)
+        stack = open_slices[tid]
+        if phase == "E":
+            if name not in stack:
+                continue          # its begin was overwritten
+            # Close whatever was opened inside it and never ended
+            while stack[-1] != name:
+                out.append({"name": stack.pop(), "ph": "E", "ts": ts, "pid": 0,
+                            "tid": tid})
+            stack.pop()
+        elif phase == "B":
+            stack.append(name)
+        ev = {"name": name, "ph": phase, "ts": ts, "pid": 0, "tid": tid,
+              "args": {"arg": "0x%x" % arg, "cpu": cpu}}
+        if phase == "i":
+            ev["s"] = "t"            # instant scoped to its track
+        out.append(ev)
+
+    for tid, stack in open_slices.items():
+        for name in reversed(stack):
+            out.append({"name": name, "ph": "E", "ts": last_ts, "pid": 0, "tid": tid})
+    return out
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    ap.add_argument("log", help="serial log containing a TRACE dump")
+    ap.add_argument("out", help="JSON file to write ('-' for stdout)")
+    args = ap.parse_args()
+
+    with open(args.log, errors="replace") as f:
+        tsc_khz, events = parse(f)
+    if not events:
+        print("%s: no TRACE events found" % args.log, file=sys.stderr)
+        return 1
+
+    trace = {"traceEvents": convert(tsc_khz, events), "displayTimeUnit": "ns"}
+    if args.out == "-":
+        json.dump(trace, sys.stdout)
+    else:
+        with open(args.out, "w") as f:
+            json.dump(trace, f)
+    print("%d events from %d CPU(s), %d thread(s)"
+          % (len(events), len({e[2] for e in events}),
+             len({e[1] for e in events if e[1] < CPU_TRACK_BASE})), file=sys.stderr)
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())